@@ -0,0 +1,135 @@
+/*
+	jsl-arena.cpp
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_LOCAL_LEVEL ESP_LOG_NONE
+// #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+constexpr char ARENA_LOGTAG[] = "ARENA :";
+#include "jsl-port.h"
+
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+#include "jsl-arena.h"
+
+jsl_arena::~jsl_arena()
+{
+	reset();
+	drop(m_first);
+}
+
+jsl_arena::block_t* jsl_arena::grab(size_t _size)
+{
+	void* mem = nullptr;
+#ifdef ESP_PLATFORM
+	if(m_psram)
+	{
+		mem = heap_caps_malloc(HEADER + _size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	}
+#endif
+	if(mem == nullptr) // no PSRAM, or full
+	{
+		mem = malloc(HEADER + _size);
+		if(mem == nullptr) return nullptr;
+	}
+
+	block_t* block = static_cast<block_t*>(mem);
+	block->m_next = nullptr;
+	block->m_size = _size;
+	block->m_used = 0;
+	return block;
+}
+
+void jsl_arena::drop(block_t* _block)
+{
+	free(_block); // heap_caps_malloc'ed too
+}
+
+void* jsl_arena::alloc(size_t _len, size_t _align)
+{
+	if(m_last != nullptr)
+	{
+		size_t off = (m_last->m_used + _align - 1) & ~(_align - 1);
+		if(off + _len <= m_last->m_size)
+		{
+			m_last->m_used = off + _len;
+			return reinterpret_cast<char*>(m_last) + HEADER + off;
+		}
+	}
+
+	// next block, a bigger one when _len wouldn't fit the usual size
+	block_t* block = grab(_len > m_block ? _len : m_block);
+	if(block == nullptr)
+	{
+		ESP_LOGE(ARENA_LOGTAG,"Out of memory (%u bytes)",(unsigned)_len);
+		return nullptr;
+	}
+	ESP_LOGD(ARENA_LOGTAG,"New block (%u bytes)",(unsigned)block->m_size);
+
+	if(m_last != nullptr) m_last->m_next = block;
+	else m_first = block;
+	m_last = block;
+
+	block->m_used = _len;
+	return reinterpret_cast<char*>(block) + HEADER;
+}
+
+std::string_view jsl_arena::dup(std::string_view _str)
+{
+	if(_str.empty()) return std::string_view();
+
+	char* p = static_cast<char*>(alloc(_str.size(), 1));
+	if(p == nullptr) return std::string_view();
+	memcpy(p, _str.data(), _str.size());
+	return std::string_view(p, _str.size());
+}
+
+void jsl_arena::reset()
+{
+	if(m_first == nullptr) return;
+
+	block_t* b = m_first->m_next;
+	while(b != nullptr)
+	{
+		block_t* next = b->m_next;
+		drop(b);
+		b = next;
+	}
+
+	if(m_first->m_size > m_block) // an oversized one isn't worth keeping
+	{
+		drop(m_first);
+		m_first = nullptr;
+		m_last = nullptr;
+		return;
+	}
+
+	m_first->m_next = nullptr;
+	m_first->m_used = 0;
+	m_last = m_first;
+}
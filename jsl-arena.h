@@ -0,0 +1,112 @@
+/*
+	jsl-arena.h
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+
+#ifndef JSL_ARENA_H
+#define JSL_ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "jsl-port.h"
+
+// Bump allocator for what lives as long as a request : blocks are carved
+// front to back, nothing is freed on its own, reset() takes it all back at
+// once and keeps the first block for the next request. Blocks may come from
+// PSRAM, leaving the internal heap unfragmented by request churn.
+// allocator<T> plugs it in the standard containers, without an arena it
+// falls back on the heap (containers built at setup, routes...).
+
+class jsl_arena
+{
+public:
+
+	jsl_arena(size_t _block = 2048, bool _psram = false) : m_first(nullptr), m_last(nullptr), m_block(_block), m_psram(_psram) {}
+	~jsl_arena();
+	jsl_arena(const jsl_arena&) = delete; // a copy would free the same blocks
+	jsl_arena& operator=(const jsl_arena&) = delete;
+
+	void* alloc(size_t _len, size_t _align = alignof(std::max_align_t)); // nullptr when out of memory
+	std::string_view dup(std::string_view _str); // copy owned by the arena
+	void reset();
+
+	template<typename T>
+	class allocator
+	{
+	public:
+
+		typedef T value_type;
+		typedef std::true_type propagate_on_container_copy_assignment;
+		typedef std::true_type propagate_on_container_move_assignment; // a container takes the arena it's assigned
+		typedef std::true_type propagate_on_container_swap;
+
+		allocator(jsl_arena* _arena = nullptr) : m_arena(_arena) {}
+		template<typename U> allocator(const allocator<U>& _other) : m_arena(_other.m_arena) {}
+
+		T* allocate(size_t _n)
+		{
+			if(m_arena == nullptr) return static_cast<T*>(::operator new(_n * sizeof(T)));
+
+			void* p = m_arena->alloc(_n * sizeof(T), alignof(T));
+			if(p == nullptr) abort(); // as operator new does, built without exceptions
+			return static_cast<T*>(p);
+		}
+
+		void deallocate(T* _p, size_t _n)
+		{
+			if(m_arena == nullptr) ::operator delete(_p); // the arena frees on reset
+		}
+
+		template<typename U> bool operator==(const allocator<U>& _other) const { return m_arena == _other.m_arena; }
+		template<typename U> bool operator!=(const allocator<U>& _other) const { return m_arena != _other.m_arena; }
+
+		jsl_arena* m_arena;
+	};
+
+protected:
+
+	typedef struct block_t
+	{
+		block_t* m_next;
+		size_t m_size; // usable bytes past the header
+		size_t m_used;
+	} block_t;
+
+	static constexpr size_t HEADER = (sizeof(block_t) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1); // keeps the data aligned
+
+	block_t* grab(size_t _size);
+	static void drop(block_t* _block);
+
+	block_t* m_first; // kept across resets
+	block_t* m_last; // carved from
+	size_t m_block;
+	bool m_psram;
+};
+
+#endif // #ifndef JSL_ARENA_H
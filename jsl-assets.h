@@ -0,0 +1,50 @@
+/*
+	jsl-assets.h
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+#ifndef JSL_ASSETS_H
+#define JSL_ASSETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Embedded asset pack, as generated by jsl-assets.py from a web directory.
+// Everything is const so it stays in flash : the bytes (gzipped when that
+// pays), the ETag, and the header block sent after the status line, down
+// to the empty line. Serving one only copies the status line and the
+// connection headers, the rest is written straight from flash. Only the
+// gzipped bytes are kept, clients that don't accept gzip get a 406.
+
+typedef struct
+{
+	const char* m_path; // "/index.html"
+	const char* m_etag; // quoted
+	const char* m_head; // "Content-Type: ...\r\n ... \r\n\r\n"
+	uint32_t m_hlen;
+	const uint8_t* m_data;
+	uint32_t m_len;
+	bool m_gzip; // m_head has Content-Encoding: gzip and Vary: Accept-Encoding
+} jsl_asset_t;
+
+#endif // #ifndef JSL_ASSETS_H
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+#
+#	jsl-assets.py
+#
+#	This scource file is part of the jsl-esp32 project.
+#
+#	Author: Lorenzo Pastrana
+#	Copyright © 2019 Lorenzo Pastrana
+#
+#	This program is free software: you can redistribute it and/or modify it
+#	under the terms of the GNU General Public License as published by the
+#	Free Software Foundation, either version 3 of the License, or (at your
+#	option) any later version.
+#
+#	This program is distributed in the hope that it will be useful, but
+#	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+#	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+#	for more details.
+#
+#	You should have received a copy of the GNU General Public License along
+#	with this program. If not, see http://www.gnu.org/licenses/.
+#
+#
+# Turns a web directory into a C++ asset table (see jsl-assets.h).
+#
+#	jsl-assets.py <web dir> <out.cpp> [--name web] [--prefix /static] [--max-age 31536000]
+#
+# declares : extern const jsl_asset_t web_assets[]; extern const size_t web_assets_count;
+
+import argparse
+import gzip
+import hashlib
+import mimetypes
+import os
+import re
+import sys
+
+# same MIME table as the server (jsl-common.cpp), python's guess otherwise
+def load_mime():
+	mime = {}
+	common = os.path.join(os.path.dirname(os.path.abspath(__file__)), "jsl-common.cpp")
+	if os.path.exists(common):
+		with open(common) as f:
+			for ext, kind in re.findall(r'\{"(\.[^"]+)",\s*"([^"]+)"\}', f.read()):
+				mime[ext] = kind
+	return mime
+
+def mime_of(path, mime):
+	ext = os.path.splitext(path)[1].lower()
+	if ext in mime:
+		return mime[ext]
+	guess = mimetypes.guess_type(path)[0]
+	return guess if guess else "application/octet-stream"
+
+def c_bytes(data):
+	lines = []
+	for i in range(0, len(data), 24):
+		lines.append("\t" + ",".join("0x%02x" % b for b in data[i:i + 24]) + ",")
+	return "\n".join(lines)
+
+def c_string(text):
+	return '"' + text.replace("\\", "\\\\").replace('"', '\\"').replace("\r", "\\r").replace("\n", "\\n") + '"'
+
+def main():
+	parser = argparse.ArgumentParser(description="Embed a web directory as a jsl_asset_t table")
+	parser.add_argument("dir")
+	parser.add_argument("out")
+	parser.add_argument("--name", default="web", help="table symbols prefix (web_assets, web_assets_count)")
+	parser.add_argument("--prefix", default="", help="url prefix the directory is served under")
+	parser.add_argument("--max-age", type=int, default=31536000, help="Cache-Control max-age")
+	parser.add_argument("--include", default="server/jsl-assets.h", help="jsl-assets.h include path")
+	args = parser.parse_args()
+
+	mime = load_mime()
+	prefix = "/" + args.prefix.strip("/") if args.prefix.strip("/") else ""
+
+	files = []
+	for root, dirs, names in os.walk(args.dir):
+		dirs.sort()
+		for name in sorted(names):
+			if name.startswith("."):
+				continue
+			full = os.path.join(root, name)
+			rel = os.path.relpath(full, args.dir).replace(os.sep, "/")
+			files.append((prefix + "/" + rel, full))
+
+	out = []
+	out.append("// Generated by jsl-assets.py from %s, do not edit." % args.dir)
+	out.append("")
+	out.append('#include "%s"' % args.include)
+	out.append("")
+
+	entries = []
+	for i, (path, full) in enumerate(files):
+		with open(full, "rb") as f:
+			raw = f.read()
+
+		packed = gzip.compress(raw, 9, mtime=0)
+		zipped = len(packed) < len(raw) * 0.9 # already compressed formats don't shrink
+		data = packed if zipped else raw
+		etag = '"%s"' % hashlib.sha1(raw).hexdigest()[:16]
+
+		head = "Content-Type: %s\r\n" % mime_of(path, mime)
+		if zipped: # served only to clients accepting it (406 otherwise)
+			head += "Content-Encoding: gzip\r\n"
+			head += "Vary: Accept-Encoding\r\n"
+		head += "Content-Length: %d\r\n" % len(data)
+		head += "ETag: %s\r\n" % etag
+		head += "Cache-Control: public, max-age=%d\r\n" % args.max_age
+		head += "\r\n"
+
+		out.append("// %s (%d bytes%s)" % (path, len(raw), ", gzipped to %d" % len(data) if zipped else ""))
+		out.append("static const uint8_t s_data_%d[] = {" % i)
+		out.append(c_bytes(data) if data else "\t0x00 // empty")
+		out.append("};")
+		out.append("static const char s_head_%d[] = %s;" % (i, c_string(head)))
+		out.append("")
+
+		entries.append((path, etag, i, len(data), zipped))
+		if os.path.basename(path) == "index.html": # the directory serves its index
+			entries.append((path[:-len("index.html")], etag, i, len(data), zipped))
+
+	out.append("extern const jsl_asset_t %s_assets[] = {" % args.name)
+	for path, etag, i, length, zipped in sorted(entries):
+		out.append("\t{%s, %s, s_head_%d, sizeof(s_head_%d) - 1, s_data_%d, %d, %s}," % (
+			c_string(path), c_string(etag), i, i, i, length, "true" if zipped else "false"))
+	out.append("};")
+	out.append("extern const size_t %s_assets_count = %d;" % (args.name, len(entries)))
+	out.append("")
+
+	with open(args.out, "w") as f:
+		f.write("\n".join(out))
+
+	print("%s : %d assets" % (args.out, len(entries)), file=sys.stderr)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,147 @@
+/*
+	jsl-body.cpp
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+#include <algorithm>
+#include <new>
+#include <string.h>
+
+#define LOG_LOCAL_LEVEL ESP_LOG_NONE
+// #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+constexpr char BODY_LOGTAG[] = "BODY :";
+#include "jsl-port.h"
+
+#include "jsl-body.h"
+
+jsl_queue<jsl_body::chunk_t*>* jsl_body::s_pool = nullptr;
+
+void jsl_body::reserve(size_t _count)
+{
+	if(s_pool != nullptr || _count == 0) return;
+
+	jsl_queue<chunk_t*>* pool = new jsl_queue<chunk_t*>(_count);
+	for(size_t i = 0; i < _count; ++i)
+	{
+		pool->push(new chunk_t);
+	}
+	s_pool = pool;
+}
+
+jsl_body::chunk_t* jsl_body::acquire()
+{
+	chunk_t* chunk;
+	if(s_pool == nullptr || !s_pool->pop(chunk))
+	{
+		ESP_LOGD(BODY_LOGTAG,"Pool drained, chunk from the heap");
+		chunk = new (std::nothrow) chunk_t;
+		if(chunk == nullptr) return nullptr;
+	}
+	chunk->m_next = nullptr;
+	chunk->m_len = 0;
+	return chunk;
+}
+
+void jsl_body::release(chunk_t* _chunk)
+{
+	if(s_pool == nullptr || !s_pool->push(_chunk))
+	{
+		delete _chunk;
+	}
+}
+
+const jsl_body::chunk_t* jsl_body::chunks()
+{
+	if(m_last != nullptr)
+	{
+		m_last->m_len = pptr() - pbase();
+	}
+	return m_first;
+}
+
+void jsl_body::clear()
+{
+	while(m_first != nullptr)
+	{
+		chunk_t* next = m_first->m_next;
+		release(m_first);
+		m_first = next;
+	}
+	m_last = nullptr;
+	m_size = 0;
+	setp(nullptr, nullptr);
+}
+
+bool jsl_body::grow()
+{
+	chunk_t* chunk = acquire();
+	if(chunk == nullptr) return false;
+
+	if(m_last != nullptr)
+	{
+		m_last->m_len = pptr() - pbase();
+		m_size += m_last->m_len;
+		m_last->m_next = chunk;
+	}
+	else
+	{
+		m_first = chunk;
+	}
+	m_last = chunk;
+	setp(chunk->m_data, chunk->m_data + CHUNK);
+	return true;
+}
+
+jsl_body::int_type jsl_body::overflow(int_type _c)
+{
+	if(!grow()) return traits_type::eof();
+
+	if(!traits_type::eq_int_type(_c, traits_type::eof()))
+	{
+		*pptr() = traits_type::to_char_type(_c);
+		pbump(1);
+	}
+	return traits_type::not_eof(_c);
+}
+
+std::streamsize jsl_body::xsputn(const char* _data, std::streamsize _len)
+{
+	std::streamsize done = 0;
+	while(done < _len)
+	{
+		if(pptr() == epptr() && !grow()) break;
+
+		size_t len = std::min((size_t)(epptr() - pptr()), (size_t)(_len - done));
+		memcpy(pptr(), _data + done, len);
+		pbump(len);
+		done += len;
+	}
+	return done;
+}
+
+jsl_body::pos_type jsl_body::seekoff(off_type _off, std::ios_base::seekdir _dir, std::ios_base::openmode _which)
+{
+	// append only : the write position is the end
+	if(_off != 0 || _dir == std::ios_base::beg || !(_which & std::ios_base::out)) return pos_type(off_type(-1));
+	return pos_type(off_type(size()));
+}
@@ -0,0 +1,82 @@
+/*
+	jsl-body.h
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+
+#ifndef JSL_BODY_H
+#define JSL_BODY_H
+
+#include <streambuf>
+#include <stddef.h>
+
+#include "jsl-port.h"
+#include "jsl-queue.h"
+
+// Response body : a list of fixed size chunks taken from a shared pool,
+// written to through an ostream and sent chunk by chunk without ever being
+// flattened. The pool is a lock free queue filled once by reserve(), it
+// falls back on the heap when drained and takes back what it has room for.
+
+class jsl_body :
+	public std::streambuf
+{
+public:
+
+	static constexpr size_t CHUNK = 512;
+
+	typedef struct chunk_t
+	{
+		chunk_t* m_next;
+		size_t m_len;
+		char m_data[CHUNK];
+	} chunk_t;
+
+	jsl_body() : m_first(nullptr), m_last(nullptr), m_size(0) {}
+	~jsl_body() { clear(); }
+
+	static void reserve(size_t _count); // preallocates the pool, once
+
+	inline size_t size() const { return m_size + (pptr() - pbase()); } // O(1)
+	const chunk_t* chunks(); // settles the last one, nullptr if empty
+	void clear(); // back to the pool
+
+protected:
+
+	virtual int_type overflow(int_type _c);
+	virtual std::streamsize xsputn(const char* _data, std::streamsize _len);
+	virtual pos_type seekoff(off_type _off, std::ios_base::seekdir _dir, std::ios_base::openmode _which); // tellp only
+
+	bool grow();
+
+	static chunk_t* acquire();
+	static void release(chunk_t* _chunk);
+
+	chunk_t* m_first;
+	chunk_t* m_last; // being written, its m_len lags behind pptr()
+	size_t m_size; // in the chunks before m_last
+
+	static jsl_queue<chunk_t*>* s_pool;
+};
+
+#endif // #ifndef JSL_BODY_H
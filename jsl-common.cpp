@@ -23,9 +23,148 @@
 
 
 
+#include <string.h>
+
 #include "jsl-common.h"
 
 constexpr const jsl_http_common::statinfo_t jsl_http_common::statcm[jsl_http_common::STATUS_MAX];
+constexpr const char* jsl_http_common::methods[jsl_http_common::METHOD_MAX];
+
+jsl_http_common::method_t jsl_http_common::parse_method(std::string_view _method)
+{
+	// the length narrows it down to one or two candidates
+	int first, last;
+	switch(_method.size())
+	{
+		case 3: first = METHOD_GET; last = METHOD_PUT; break; // GET, PUT
+		case 4: first = METHOD_HEAD; last = METHOD_POST; break;
+		case 5: first = last = METHOD_PATCH; break;
+		case 6: first = last = METHOD_DELETE; break;
+		case 7: first = last = METHOD_OPTIONS; break;
+		default: return METHOD_MAX;
+	}
+
+	for(int m = first; m <= last; ++m)
+	{
+		if(strlen(methods[m]) == _method.size() && strncasecmp(methods[m],_method.data(),_method.size()) == 0) return (method_t)m;
+	}
+	return METHOD_MAX;
+}
+
+bool jsl_http_common::scan_uint(std::string_view _str, uint32_t* _val)
+{
+	if(_str.empty()) return false;
+
+	uint64_t val = 0;
+	for(char c : _str)
+	{
+		if(c < '0' || c > '9') return false;
+		val = val * 10 + (c - '0');
+		if(val > 0xffffffffull) return false;
+	}
+	if(_val != nullptr) *_val = val;
+	return true;
+}
+
+bool jsl_http_common::scan_int(std::string_view _str, int32_t* _val)
+{
+	bool neg = false;
+	if(_str.size() && (_str[0] == '-' || _str[0] == '+'))
+	{
+		neg = _str[0] == '-';
+		_str.remove_prefix(1);
+	}
+
+	uint32_t val;
+	if(!scan_uint(_str,&val) || val > (neg ? 0x80000000u : 0x7fffffffu)) return false;
+	if(_val != nullptr) *_val = neg ? (int32_t)(0u - val) : (int32_t)val;
+	return true;
+}
+
+bool jsl_http_common::scan_hex(std::string_view _str, uint32_t* _val)
+{
+	if(_str.empty() || _str.size() > 8) return false;
+
+	uint32_t val = 0;
+	for(char c : _str)
+	{
+		int d;
+		if(c >= '0' && c <= '9') d = c - '0';
+		else if(c >= 'a' && c <= 'f') d = c - 'a' + 10;
+		else if(c >= 'A' && c <= 'F') d = c - 'A' + 10;
+		else return false;
+		val = (val << 4) | d;
+	}
+	if(_val != nullptr) *_val = val;
+	return true;
+}
+
+bool jsl_http_common::scan_float(std::string_view _str, double* _val)
+{
+	size_t i = 0, n = _str.size();
+	bool neg = false;
+	if(i < n && (_str[i] == '-' || _str[i] == '+')) neg = _str[i++] == '-';
+
+	double val = 0;
+	size_t digits = 0;
+	for(; i < n && _str[i] >= '0' && _str[i] <= '9'; ++i, ++digits) val = val * 10 + (_str[i] - '0');
+
+	int exp = 0;
+	if(i < n && _str[i] == '.')
+	{
+		for(++i; i < n && _str[i] >= '0' && _str[i] <= '9'; ++i, ++digits, --exp) val = val * 10 + (_str[i] - '0');
+	}
+	if(digits == 0) return false;
+
+	if(i < n && (_str[i] == 'e' || _str[i] == 'E'))
+	{
+		int32_t e;
+		std::string_view rest = _str.substr(i + 1);
+		if(!scan_int(rest,&e) || e > 400 || e < -400) return false;
+		exp += e;
+		i = n;
+	}
+	if(i != n) return false;
+
+	if(_val != nullptr)
+	{
+		double scale = 1;
+		for(int e = exp < 0 ? -exp : exp; e > 0; --e) scale *= 10;
+		val = exp < 0 ? val / scale : val * scale;
+		*_val = neg ? -val : val;
+	}
+	return true;
+}
+
+bool jsl_http_common::scan_slug(std::string_view _str)
+{
+	if(_str.empty()) return false;
+
+	for(char c : _str)
+	{
+		if(!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_')) return false;
+	}
+	return true;
+}
+
+bool jsl_http_common::scan_tail(const path_t& _path, size_t _from, std::string_view* _val)
+{
+	if(_from >= _path.size()) return false;
+
+	for(size_t i = _from; i < _path.size(); ++i)
+	{
+		if(_path[i] == "." || _path[i] == "..") return false;
+	}
+
+	if(_val != nullptr)
+	{
+		std::string_view first = _path[_from];
+		std::string_view last = _path.back();
+		*_val = std::string_view(first.data(),last.data() + last.size() - first.data());
+	}
+	return true;
+}
+
 const jsl_http_common::pmap_t jsl_http_common::mime = {
 
 	// Mozilla's Incomplete list of MIME types
@@ -104,6 +243,17 @@ const jsl_http_common::pmap_t jsl_http_common::mime = {
 	{".3g2", "audio/3gpp2"},
 	{".7z", "application/x-7z-compressed"}
 };
+
+const char* jsl_http_common::mime_type(std::string_view _path)
+{
+	size_t dot = _path.rfind('.');
+	if(dot != std::string_view::npos && _path.find('/',dot) == std::string_view::npos)
+	{
+		auto m = mime.find(std::string(_path.substr(dot)));
+		if(m != mime.end()) return m->second.c_str();
+	}
+	return "application/octet-stream";
+}
 /*
 	// This version is more exaustive !
 	// Is it useful to us ? ... nope.
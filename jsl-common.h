@@ -30,8 +30,10 @@
 #include <ios>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <iostream>
+#include <strings.h>
 
 #ifndef LWIP_HDR_ARCH_H
 #include <stdint.h>
@@ -44,14 +46,108 @@ typedef int32_t   s32_t;
 #endif
 
 #include "utils/jsl-str.h"
+#include "jsl-arena.h"
+#include "jsl-multipart.h"
+#include "jsl-body.h"
+#include "jsl-assets.h"
 
 class jsl_http_common
 {
 public:
 
-	typedef jsl_str::svect_t path_t;
+	typedef std::vector<std::string_view,jsl_arena::allocator<std::string_view>> path_t; // per request arena, or the heap
 	typedef std::map<std::string,std::string> pmap_t;
 
+	class vmap_t // flat map of slices, looked up linearly (requests carry a handful of entries)
+	{
+	public:
+
+		typedef std::pair<std::string_view,std::string_view> value_type;
+		typedef std::vector<value_type,jsl_arena::allocator<value_type>> items_t;
+		typedef items_t::const_iterator const_iterator;
+
+		vmap_t(jsl_arena* _arena = nullptr) : m_items(jsl_arena::allocator<value_type>(_arena)) {}
+
+		inline const_iterator begin() const { return m_items.begin(); }
+		inline const_iterator end() const { return m_items.end(); }
+		inline size_t size() const { return m_items.size(); }
+		inline bool empty() const { return m_items.empty(); }
+		inline void clear() { m_items.clear(); }
+
+		const_iterator find(std::string_view _key) const
+		{
+			for(auto i = m_items.begin(); i != m_items.end(); ++i)
+			{
+				if(i->first == _key) return i;
+			}
+			return m_items.end();
+		}
+
+		const_iterator ifind(std::string_view _key) const // case insensitive (header names)
+		{
+			for(auto i = m_items.begin(); i != m_items.end(); ++i)
+			{
+				if(i->first.size() == _key.size() && strncasecmp(i->first.data(),_key.data(),_key.size()) == 0) return i;
+			}
+			return m_items.end();
+		}
+
+		std::string_view at(std::string_view _key) const // empty when missing
+		{
+			auto i = find(_key);
+			return i != m_items.end() ? i->second : std::string_view();
+		}
+
+		void set(std::string_view _key, std::string_view _val)
+		{
+			for(auto& i : m_items)
+			{
+				if(i.first == _key)
+				{
+					i.second = _val;
+					return;
+				}
+			}
+			m_items.emplace_back(_key,_val);
+		}
+
+		void iset(std::string_view _key, std::string_view _val) // case insensitive
+		{
+			auto i = ifind(_key);
+			if(i != m_items.end())
+			{
+				m_items[i - m_items.begin()].second = _val;
+				return;
+			}
+			m_items.emplace_back(_key,_val);
+		}
+
+		void ierase(std::string_view _key)
+		{
+			auto i = ifind(_key);
+			if(i != m_items.end())
+			{
+				m_items.erase(i);
+			}
+		}
+
+	protected:
+
+		items_t m_items;
+	};
+
+	static void split(path_t& _path, std::string_view _str, char _c = '/') // empty segments are skipped
+	{
+		size_t p = 0;
+		while(p < _str.size())
+		{
+			size_t n = _str.find(_c,p);
+			if(n == std::string_view::npos) n = _str.size();
+			if(n > p) _path.push_back(_str.substr(p,n - p));
+			p = n + 1;
+		}
+	}
+
 	static std::string dump_path(const char* _name, const path_t& _vec)
 	{
 		std::stringstream out;
@@ -65,7 +161,8 @@ public:
 		return out.str();
 	}
 
-	static std::string dump_pmap(const char* _name, const pmap_t& _map)
+	template<typename M> // pmap_t or vmap_t
+	static std::string dump_pmap(const char* _name, const M& _map)
 	{
 		std::stringstream out;
 		out << _name << " : " << std::endl;
@@ -78,41 +175,58 @@ public:
 		return out.str();
 	}
 
-	static bool param(const pmap_t& _pmap, const char* _name, uint32_t& _val)
+	// Scanners behind the typed route placeholders ({id:uint}...) : the whole
+	// string must match, nothing is allocated, _val gets the number if given
+	static bool scan_uint(std::string_view _str, uint32_t* _val = nullptr); // digits, fits 32 bits
+	static bool scan_int(std::string_view _str, int32_t* _val = nullptr); // optional sign
+	static bool scan_hex(std::string_view _str, uint32_t* _val = nullptr); // up to 8 hex digits
+	static bool scan_float(std::string_view _str, double* _val = nullptr); // [-+]1[.5][e-3]
+	static bool scan_slug(std::string_view _str); // letters, digits, '-' and '_'
+
+	// The {name:**} value : segments _from to the end, with the separators of
+	// the request line. No "." or ".." segment, it would climb out of a root
+	static bool scan_tail(const path_t& _path, size_t _from, std::string_view* _val = nullptr);
+
+	template<typename M> // pmap_t or vmap_t
+	static bool param(const M& _pmap, const char* _name, uint32_t& _val) // false if missing or not a number
 	{
-		if(_pmap.find(_name) != _pmap.end())
-		{
-			std::stringstream s(_pmap.at(_name)); s >> _val;
-			return true;
-		}
-		return false;
+		auto i = _pmap.find(_name);
+		return i != _pmap.end() && scan_uint(i->second,&_val);
 	}
 
-	static bool param(const pmap_t& _pmap, const char* _name, double& _val)
+	template<typename M> // pmap_t or vmap_t
+	static bool param(const M& _pmap, const char* _name, int32_t& _val)
 	{
-		if(_pmap.find(_name) != _pmap.end())
-		{
-			std::stringstream s(_pmap.at(_name)); s >> _val;
-			return true;
-		}
-		return false;
+		auto i = _pmap.find(_name);
+		return i != _pmap.end() && scan_int(i->second,&_val);
+	}
+
+	template<typename M> // pmap_t or vmap_t
+	static bool param(const M& _pmap, const char* _name, double& _val)
+	{
+		auto i = _pmap.find(_name);
+		return i != _pmap.end() && scan_float(i->second,&_val);
 	}
 
-	static bool param(const pmap_t& _pmap, const char* _name, bool& _val)
+	template<typename M> // pmap_t or vmap_t
+	static bool param(const M& _pmap, const char* _name, bool& _val)
 	{
-		if(_pmap.find(_name) != _pmap.end())
+		auto i = _pmap.find(_name);
+		if(i != _pmap.end())
 		{
-			std::stringstream s(_pmap.at(_name)); s >> std::boolalpha >> _val;
+			std::stringstream s{std::string(i->second)}; s >> std::boolalpha >> _val;
 			return true;
 		}
 		return false;
 	}
 
-	static bool param(const pmap_t& _pmap, const char* _name, std::string& _val)
+	template<typename M> // pmap_t or vmap_t
+	static bool param(const M& _pmap, const char* _name, std::string& _val)
 	{
-		if(_pmap.find(_name) != _pmap.end())
+		auto i = _pmap.find(_name);
+		if(i != _pmap.end())
 		{
-			std::stringstream s(_pmap.at(_name)); s >> _val;
+			std::stringstream s{std::string(i->second)}; s >> _val;
 			return true;
 		}
 		return false;
@@ -122,14 +236,20 @@ public:
 	typedef enum
 	{
 		STATUS_OK,
+		STATUS_PARTIAL_CONTENT,
 		STATUS_MULTIPLE_CHOICES,
+		STATUS_NOT_MODIFIED,
 		STATUS_BAD_REQUEST,
 		STATUS_UNAUTHORIZED,
 		STATUS_FORBIDDEN,
 		STATUS_NOT_FOUND,
 		STATUS_METHOD_NOT_ALLOWED,
+		STATUS_NOT_ACCEPTABLE,
+		STATUS_PAYLOAD_TOO_LARGE,
 		STATUS_REQUEST_URI_TOO_LONG,
 		STATUS_UNSUPPORTED_MEDIA_TYPE,
+		STATUS_RANGE_NOT_SATISFIABLE,
+		STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE,
 		STATUS_INTERNAL_SERVER_ERROR,
 		STATUS_NOT_IMPLEMENTED,
 		STATUS_HTTP_VERSION_NOT_SUPPORTED,
@@ -139,53 +259,93 @@ public:
 	typedef struct {
 		uint code;
 		const char* msg;
+		const char* line; // status line, CRLF included
+		u8_t len;
 	} statinfo_t;
 
+#define STATUS_LINE(_code,_msg) {_code,_msg,"HTTP/1.1 " #_code " " _msg "\r\n",sizeof("HTTP/1.1 " #_code " " _msg "\r\n") - 1}
 	constexpr static const statinfo_t statcm[STATUS_MAX] {
-		{200,"Ok"},
-		{300,"Multiple Choices"},
-		{400,"Bad Request"},
-		{401,"Unauthorized"},
-		{403,"Forbidden"},
-		{404,"Not Found"},
-		{405,"Method Not Allowed"},
-		{414,"Request Uri Too Long"},
-		{415,"Unsupported Media Type"},
-		{500,"Internal Server Error"},
-		{501,"Not Implemented"},
-		{505,"Http Version Not Supported"}
+		STATUS_LINE(200,"Ok"),
+		STATUS_LINE(206,"Partial Content"),
+		STATUS_LINE(300,"Multiple Choices"),
+		STATUS_LINE(304,"Not Modified"),
+		STATUS_LINE(400,"Bad Request"),
+		STATUS_LINE(401,"Unauthorized"),
+		STATUS_LINE(403,"Forbidden"),
+		STATUS_LINE(404,"Not Found"),
+		STATUS_LINE(405,"Method Not Allowed"),
+		STATUS_LINE(406,"Not Acceptable"),
+		STATUS_LINE(413,"Payload Too Large"),
+		STATUS_LINE(414,"Request Uri Too Long"),
+		STATUS_LINE(415,"Unsupported Media Type"),
+		STATUS_LINE(416,"Range Not Satisfiable"),
+		STATUS_LINE(431,"Request Header Fields Too Large"),
+		STATUS_LINE(500,"Internal Server Error"),
+		STATUS_LINE(501,"Not Implemented"),
+		STATUS_LINE(505,"Http Version Not Supported")
 	};
+#undef STATUS_LINE
 
-	typedef struct _req_t // read only capsule
+	typedef enum
+	{
+		METHOD_GET,
+		METHOD_HEAD,
+		METHOD_POST,
+		METHOD_PUT,
+		METHOD_DELETE,
+		METHOD_PATCH,
+		METHOD_OPTIONS,
+		METHOD_MAX // unknown
+	} method_t;
+
+	constexpr static const char* methods[METHOD_MAX] {
+		"GET",
+		"HEAD",
+		"POST",
+		"PUT",
+		"DELETE",
+		"PATCH",
+		"OPTIONS"
+	};
+
+	static method_t parse_method(std::string_view _method); // case insensitive, METHOD_MAX if unknown
+
+	typedef struct _req_t // read only capsule, slices of the connection buffer : copy what must outlive the target call
 	{
 	public:
 
-		inline const std::string& method() const { return m_method; }
-		inline const std::string& uri() const { return m_uri; }
+		_req_t(jsl_arena* _arena = nullptr) : m_path(jsl_arena::allocator<std::string_view>(_arena)), m_args(_arena), m_query(_arena), m_form(_arena), m_headers(_arena) {}
+
+		inline std::string_view method() const { return m_method; }
+		inline method_t method_id() const { return m_method_id; }
+		inline std::string_view uri() const { return m_uri; }
 		inline const path_t& path() const { return m_path; }
-		inline const pmap_t& args() const { return m_args; }
-		inline const pmap_t& query() const { return m_query; }
-		inline const pmap_t& form() const { return m_form; }
-		inline const pmap_t& headers() const { return m_headers; }
-		std::string header(const char* _header) const
+		inline const vmap_t& args() const { return m_args; }
+		inline const vmap_t& query() const { return m_query; }
+		inline const vmap_t& form() const { return m_form; }
+		inline const vmap_t& headers() const { return m_headers; }
+		inline jsl_multipart::handler* upload() const { return m_upload; } // on upload routes, what the body was streamed to
+		std::string_view header(const char* _header) const
 		{
-			auto h = m_headers.find(_header);
+			auto h = m_headers.ifind(_header);
 			if(h != m_headers.end())
 			{
 				return h->second;
 			}
-			return "";
+			return std::string_view();
 		}
 
 	protected:
 
-		std::string m_method;
-		std::string m_uri;
+		std::string_view m_method;
+		method_t m_method_id = METHOD_MAX;
+		std::string_view m_uri;
 		path_t m_path;
-		pmap_t m_args;
-		pmap_t m_query;
-		pmap_t m_form;
-		pmap_t m_headers;
+		vmap_t m_args;
+		vmap_t m_query;
+		vmap_t m_form;
+		vmap_t m_headers;
+		jsl_multipart::handler* m_upload = nullptr;
 
 	} req_t;
 
@@ -193,75 +353,104 @@ public:
 	{
 	public:
 
-		inline operator std::ostringstream& () { return m_out; }
-
-		inline u32_t size()
+		_res_t(jsl_arena* _arena = nullptr) : m_arena(_arena != nullptr ? _arena : &m_own), m_headers(m_arena)
 		{
-			m_out.seekp(0, std::ios::end);
-			return m_out.tellp();
+			static_cast<std::ios&>(m_out).rdbuf(&m_body); // pooled chunks, str() stays empty
 		}
 
-		std::string header(const char* _header)
+		inline operator std::ostringstream& () { return m_out; }
+
+		inline u32_t size() const { return m_body.size(); }
+
+		std::string_view header(const char* _header) const
 		{
-			auto h = m_headers.find(_header);
+			auto h = m_headers.ifind(_header);
 			if(h != m_headers.end())
 			{
 				return h->second;
 			}
-			return "";
+			return std::string_view();
 		}
 
-		void header(const char* _name, const char* _value)
+		void header(std::string_view _name, std::string_view _value) // both copied to the arena
 		{
-			m_headers[_name] = _value;
+			m_headers.iset(m_arena->dup(_name),m_arena->dup(_value));
 		}
 
 		void write_error(status_t _status)
 		{
-			if(size() > 0) m_headers["Content-type"] = "text/html";
+			if(size() > 0) header("Content-type","text/html");
 			write(_status);
 		}
 
 		void write_file(const char* _type)
 		{
-			m_headers["Content-type"] = _type;
+			header("Content-type",_type);
 			write(STATUS_OK);
 		}
 
 		void write_gzip(const char* _type)
 		{
-			m_headers["Content-type"] = _type;
-			m_headers["Accept-Ranges"] = "bytes";
-			m_headers["Content-Encoding"] = "gzip";
+			header("Content-type",_type);
+			header("Accept-Ranges","bytes");
+			header("Content-Encoding","gzip");
 			write(STATUS_OK);
 		}
 
 		void write_json()
 		{
-			m_headers["Content-type"] = "application/json";
-			m_headers["Cache-Control"] = "no-store, no-cache, must-revalidate, max-age=0";
-			m_headers["Pragma"] = "no-cache";
+			header("Content-type","application/json");
+			header("Cache-Control","no-store, no-cache, must-revalidate, max-age=0");
+			header("Pragma","no-cache");
 			write(STATUS_OK);
 		}
 
 		void write_cached(const char* _type)
 		{
-			m_headers["Content-type"] = _type;
-			m_headers["Cache-Control"] = "public, max-age=31536000";
+			header("Content-type",_type);
+			header("Cache-Control","public, max-age=31536000");
+			header("ETag",etag()); // revalidated by write
 			write(STATUS_OK);
 		}
 
 		virtual void write(status_t _status) = 0;
+		virtual void write_asset(const jsl_asset_t& _asset) = 0; // 200, flash resident bytes sent without copy
+		virtual bool send_file(const char* _path, const char* _type = nullptr, const char* _encoding = nullptr) = 0; // 200, streamed from the VFS, false if it can't be read
+
+		// Streaming : the status and headers go out right away, what is written
+		// next is sent in chunks as the buffer fills (or on flush), write() or
+		// the target returning ends it. For bodies that don't fit in RAM.
+		virtual void stream(status_t _status) = 0;
 
 	protected:
 
-		pmap_t m_headers;
-		std::ostringstream m_out;
+		std::string etag() // content hash (FNV-1a)
+		{
+			uint64_t hash = 0xcbf29ce484222325ull;
+			for(const jsl_body::chunk_t* c = m_body.chunks(); c != nullptr; c = c->m_next)
+			{
+				for(size_t i = 0; i < c->m_len; ++i)
+				{
+					hash = (hash ^ (unsigned char)c->m_data[i]) * 0x100000001b3ull;
+				}
+			}
+			char tag[24];
+			snprintf(tag, sizeof(tag), "\"%016llx\"", (unsigned long long)hash);
+			return tag;
+		}
+
+		jsl_arena m_own; // when none is given, allocates nothing until used
+		jsl_arena* m_arena; // headers storage, reset with the request
+		vmap_t m_headers;
+		jsl_body m_body;
+		std::ostringstream m_out; // writes to m_body
 	} res_t;
 
 	typedef void (*target_t) (const req_t& _req, res_t& _res);
+	typedef jsl_multipart::handler* (*upload_t) (const req_t& _req); // nullptr refuses the upload, deleted once answered
 
 	static const pmap_t mime;
+	static const char* mime_type(std::string_view _path); // by extension
 };
 
 #endif // #ifndef JSL_SERVER_COMMON_H
@@ -0,0 +1,272 @@
+/*
+	jsl-epoll.cpp
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define LOG_LOCAL_LEVEL ESP_LOG_NONE
+// #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+constexpr char EPOLL_LOGTAG[] = "EPOLL :";
+#include "jsl-port.h"
+
+#include "jsl-epoll.h"
+
+static err_t errno_to_err(int _errno)
+{
+	switch(_errno)
+	{
+		case EAGAIN: return ERR_WOULDBLOCK;
+		case ENOMEM: return ERR_MEM;
+		case ECONNRESET: return ERR_RST;
+		case EPIPE: return ERR_CLSD;
+		case ETIMEDOUT: return ERR_TIMEOUT;
+		case EADDRINUSE: return ERR_USE;
+		default: return ERR_CONN;
+	}
+}
+
+constexpr int SEND_TIMEOUT = 10000; // ms a blocked write may wait for room
+constexpr int MAX_EVENTS = 32;
+constexpr int MAX_VEC = 16; // iovecs per sendmsg
+
+err_t jsl_epoll::listen(u16_t _port, u16_t _max_conns)
+{
+	m_listen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if(m_listen < 0) return errno_to_err(errno);
+
+	int on = 1;
+	setsockopt(m_listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(_port);
+
+	if(
+		bind(m_listen, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+		::listen(m_listen, SOMAXCONN) < 0
+	){
+		err_t ret = errno_to_err(errno);
+		ESP_LOGE(EPOLL_LOGTAG,"Listen failed on port %d (%d)",_port,errno);
+		shutdown();
+		return ret;
+	}
+
+	m_epoll = epoll_create1(0);
+	m_wake = eventfd(0, EFD_NONBLOCK);
+
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr; // listener
+	epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listen, &ev);
+
+	ev.data.ptr = this; // wake up
+	epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &ev);
+
+	return ERR_OK;
+}
+
+int jsl_epoll::wait(event_t* _events, int _max, u32_t _timeout)
+{
+	epoll_event evs[MAX_EVENTS];
+	int ready = epoll_wait(m_epoll, evs, _max < MAX_EVENTS ? _max : MAX_EVENTS, _timeout);
+	if(ready < 0)
+	{
+		return errno == EINTR ? 0 : -1;
+	}
+
+	int count = 0;
+	for(int i = 0; i < ready && count < _max; ++i)
+	{
+		if(evs[i].data.ptr == nullptr)
+		{
+			count += accept(_events + count, _max - count);
+			continue;
+		}
+
+		if(evs[i].data.ptr == this)
+		{
+			eventfd_t val;
+			eventfd_read(m_wake, &val);
+			continue;
+		}
+
+		sconn* c = (sconn*)evs[i].data.ptr;
+		u8_t flags = 0;
+		if(evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) flags |= EVENT_READ; // all surface through recv
+		if(evs[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) flags |= EVENT_WRITE; // or send
+		if((flags &= c->m_events) == 0) continue;
+
+		_events[count].m_conn = c;
+		_events[count].m_flags = flags;
+		++count;
+	}
+
+	return count;
+}
+
+int jsl_epoll::accept(event_t* _events, int _max)
+{
+	int count = 0;
+	while(count < _max) // the listener stays ready (level triggered) if we run out of room
+	{
+		int fd = accept4(m_listen, nullptr, nullptr, SOCK_NONBLOCK);
+		if(fd < 0)
+		{
+			return count;
+		}
+
+		int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		sconn* c = new sconn(fd);
+
+		epoll_event ev = {};
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+
+		_events[count].m_conn = c;
+		_events[count].m_flags = EVENT_ACCEPT | EVENT_READ;
+		++count;
+	}
+	return count;
+}
+
+void jsl_epoll::wake()
+{
+	eventfd_write(m_wake, 1);
+}
+
+void jsl_epoll::watch(conn* _conn, u8_t _events)
+{
+	sconn* c = static_cast<sconn*>(_conn);
+	if(_events == c->m_events) return;
+
+	// out of the set while muted : EPOLLHUP and EPOLLERR are reported (level
+	// triggered) whatever the mask, a hang up would keep wait() spinning
+	epoll_event ev = {};
+	ev.events = 0;
+	if(_events & EVENT_READ) ev.events |= EPOLLIN;
+	if(_events & EVENT_WRITE) ev.events |= EPOLLOUT;
+	ev.data.ptr = c;
+	epoll_ctl(m_epoll, _events == 0 ? EPOLL_CTL_DEL : c->m_events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, c->m_fd, &ev);
+	c->m_events = _events;
+}
+
+void jsl_epoll::close(conn* _conn)
+{
+	sconn* c = static_cast<sconn*>(_conn);
+	::close(c->m_fd); // also drops it from the epoll set
+	delete c;
+}
+
+void jsl_epoll::shutdown()
+{
+	if(m_wake >= 0) ::close(m_wake);
+	if(m_epoll >= 0) ::close(m_epoll);
+	if(m_listen >= 0) ::close(m_listen);
+	m_wake = m_epoll = m_listen = -1;
+}
+
+err_t jsl_epoll::sconn::recv(char* _buf, size_t _len, size_t& _read)
+{
+	_read = 0;
+
+	ssize_t len = ::recv(m_fd, _buf, _len, 0);
+	if(len < 0) return errno_to_err(errno);
+	if(len == 0) return ERR_CLSD;
+
+	_read = len;
+	return ERR_OK;
+}
+
+err_t jsl_epoll::sconn::send(const vec_t* _vec, int _count, size_t& _sent, bool _copy)
+{
+	_sent = 0;
+
+	iovec iov[MAX_VEC];
+	while(_count > 0)
+	{
+		int count = 0;
+		size_t len = 0;
+		for(; count < MAX_VEC && count < _count; ++count)
+		{
+			iov[count].iov_base = const_cast<void*>(_vec[count].m_data);
+			iov[count].iov_len = _vec[count].m_len;
+			len += _vec[count].m_len;
+		}
+
+		msghdr msg = {};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		ssize_t sent = ::sendmsg(m_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(sent < 0)
+		{
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN) return ERR_OK; // full
+			return errno_to_err(errno);
+		}
+
+		_sent += sent;
+		if((size_t)sent < len) break; // full
+		_vec += count;
+		_count -= count;
+	}
+	return ERR_OK;
+}
+
+err_t jsl_epoll::sconn::write(const void* _data, size_t _len, bool _copy)
+{
+	const char* data = (const char*)_data;
+	while(_len > 0)
+	{
+		ssize_t len = ::send(m_fd, data, _len, MSG_NOSIGNAL);
+		if(len < 0)
+		{
+			if(errno == EINTR) continue;
+			if(errno != EAGAIN) return errno_to_err(errno);
+
+			pollfd pfd = { m_fd, POLLOUT, 0 };
+			if(poll(&pfd, 1, SEND_TIMEOUT) <= 0) return ERR_TIMEOUT;
+			continue;
+		}
+		data += len;
+		_len -= len;
+	}
+	return ERR_OK;
+}
+
+#endif // #ifdef __linux__
@@ -0,0 +1,69 @@
+/*
+	jsl-epoll.h
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+#ifndef JSL_EPOLL_H
+#define JSL_EPOLL_H
+
+#include "jsl-transport.h"
+
+class jsl_epoll : // Linux sockets backend (dev box stand-in)
+	public jsl_transport
+{
+public:
+
+	jsl_epoll() : m_listen(-1), m_epoll(-1), m_wake(-1) {}
+
+	virtual err_t listen(u16_t _port, u16_t _max_conns);
+	virtual int wait(event_t* _events, int _max, u32_t _timeout);
+	virtual void wake();
+	virtual void watch(conn* _conn, u8_t _events);
+	virtual void close(conn* _conn);
+	virtual void shutdown();
+
+protected:
+
+	class sconn :
+		public conn
+	{
+	public:
+
+		sconn(int _fd) : m_fd(_fd), m_events(EVENT_READ) {}
+
+		virtual err_t recv(char* _buf, size_t _len, size_t& _read);
+		virtual err_t send(const vec_t* _vec, int _count, size_t& _sent, bool _copy = true);
+		virtual err_t write(const void* _data, size_t _len, bool _copy = true);
+
+		int m_fd;
+		u8_t m_events; // watched, none : out of the epoll set
+	};
+
+	int accept(event_t* _events, int _max);
+
+	int m_listen;
+	int m_epoll;
+	int m_wake; // eventfd
+};
+
+#endif // #ifndef JSL_EPOLL_H
@@ -22,22 +22,58 @@
 */
 
 
+#include <algorithm>
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <sys/stat.h>
 
 #define LOG_LOCAL_LEVEL ESP_LOG_NONE
 // #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 constexpr char SERVER_LOGTAG[] = "HTTP :";
-#include <esp_log.h>
+#include "jsl-port.h"
 
 #include "utils/jsl-str.h"
 #include "jsl-http.h"
 
+#ifdef ESP_PLATFORM
+#include "jsl-netconn.h"
+static jsl_netconn s_default_transport;
+#else
+#include "jsl-epoll.h"
+static jsl_epoll s_default_transport;
+#endif
+
 EventGroupHandle_t jsl_http::s_event_group;
+jsl_transport* jsl_http::s_transport = &s_default_transport;
+jsl_http::config_t jsl_http::s_config;
+std::vector<jsl_http::session*> jsl_http::s_sessions;
+jsl_queue<jsl_http::session*>* jsl_http::s_jobs = nullptr;
+jsl_queue<jsl_http::session*>* jsl_http::s_done = nullptr;
+jsl_sem* jsl_http::s_work = nullptr;
 jsl_router jsl_http::m_router;
+jsl_routes jsl_http::s_routes;
+std::map<jsl_http::target_t,jsl_http::upload_t> jsl_http::s_uploads;
+std::map<std::string_view,const jsl_asset_t*> jsl_http::s_assets;
+std::vector<jsl_http::mount_t> jsl_http::s_statics;
+
+constexpr size_t FILE_CHUNK = 1024; // send_file read buffer, on the stack
+constexpr size_t PUMP = 16 * FILE_CHUNK; // file bytes per turn, the other connections go in between
+constexpr int GATHER = 16; // pieces per send
+
+void jsl_http::configure(const config_t& _config)
+{
+	s_config = _config;
+}
 
-esp_err_t jsl_http::start(const EventGroupHandle_t _evgr)
+esp_err_t jsl_http::start(const EventGroupHandle_t _evgr, jsl_transport* _transport)
 {
 	s_event_group = _evgr;
+	if(_transport != nullptr)
+	{
+		s_transport = _transport;
+	}
 	return ESP_OK;
 }
 
@@ -47,335 +83,1394 @@ void jsl_http::run(void* _ctx)
 {
 	ESP_LOGI(SERVER_LOGTAG, "Server Task Executing on core %d\n", xPortGetCoreID());
 
+#ifdef ESP_PLATFORM
 	// This one is necessary if wifi is in station mode
 	if(s_event_group != nullptr)
 	{
 		xEventGroupWaitBits(s_event_group, 0x01, pdFALSE, pdTRUE, portMAX_DELAY );
 	}
+#endif
 
-	err_t ret;
+	err_t ret = s_transport->listen(s_config.port, s_config.max_conns);
+	if(ret != ERR_OK)
+	{
+		ESP_LOGE(SERVER_LOGTAG,"HTTP Server failed to listen on port %d",s_config.port);
+		return;
+	}
 
-	netconn *conn;
-	netconn *newconn;
+	ESP_LOGI(SERVER_LOGTAG,"HTTP Server listening...");
 
-	conn = netconn_new(NETCONN_TCP);
-	netconn_bind(conn, IP_ADDR_ANY, 80);
-	netconn_listen(conn);
+	jsl_body::reserve(s_config.body_chunks);
+	if(s_config.freeze_routes)
+	{
+		m_router.freeze(); // routes added later thaw it
+	}
+	m_router.cache(s_config.route_cache);
 
-	ESP_LOGI(SERVER_LOGTAG,"HTTP Server listening...");
+	if(s_config.workers > 0)
+	{
+		// each session sits in at most one queue, max_conns slots never overflow
+		s_jobs = new jsl_queue<session*>(s_config.max_conns);
+		s_done = new jsl_queue<session*>(s_config.max_conns);
+		s_work = new jsl_sem();
 
-	netconn_set_nonblocking(conn,1);
+		for(u8_t i = 0; i < s_config.workers; ++i)
+		{
+			s8_t core = s_config.worker_core >= 0 ? s_config.worker_core : i % jsl_task::cores();
+			if(!jsl_task::spawn(work, "jsl_http_worker", s_config.worker_stack, nullptr, s_config.worker_prio, core))
+			{
+				ESP_LOGE(SERVER_LOGTAG,"Failed to spawn worker %d",i);
+			}
+		}
+	}
+
+	jsl_transport::event_t events[16];
 
-	do
+	int count;
+	while((count = s_transport->wait(events, 16, 1000)) >= 0)
 	{
-		ret = netconn_accept(conn, &newconn);
-		if (ret == ERR_OK && newconn != nullptr)
+		for(int i = 0; i < count; ++i)
 		{
-			req request(*newconn);
-			res response(*newconn);
+			conn_t* conn = events[i].m_conn;
+
+			if(events[i].m_flags & jsl_transport::EVENT_ACCEPT)
+			{
+				if(s_sessions.size() >= s_config.max_conns)
+				{
+					ESP_LOGW(SERVER_LOGTAG,"Too many connections, dropping");
+					s_transport->close(conn);
+					continue;
+				}
+
+				session* s = new session(*conn);
+				conn->m_ctx = s;
+				s_sessions.push_back(s);
+			}
 
-			dispatch(request,response);
+			session* s = (session*)conn->m_ctx;
+			if(s->m_busy) continue; // a worker owns it, picked up again once done
+
+			if(s->sending()) // reads wait for the response to be out
+			{
+				if(events[i].m_flags & jsl_transport::EVENT_WRITE) resume(s);
+			}
+			else if(events[i].m_flags & jsl_transport::EVENT_READ)
+			{
+				process(s);
+			}
+		}
 
-			netconn_close(newconn);
-			netconn_delete(newconn);
+		session* done;
+		while(s_done != nullptr && s_done->pop(done))
+		{
+			done->m_busy = false;
+			resume(done);
 		}
 
-		vTaskDelay(pdMS_TO_TICKS(1)); /* breathe */
+		expire();
 	}
-	while(ret == ERR_OK);
 
-	netconn_close(conn);
-	netconn_delete(conn);
-}
+	while(s_sessions.size())
+	{
+		close(s_sessions.back());
+	}
 
-esp_err_t jsl_http::stop()
-{
-	return ESP_OK;
+	s_transport->shutdown();
 }
 
-void jsl_http::addRoute(const char* _method, const char* _pattern, jsl_router::target_t _target)
+void jsl_http::work(void* _ctx)
 {
-	m_router.addRoute(_method, _pattern, _target);
+	ESP_LOGI(SERVER_LOGTAG, "Worker Task Executing on core %d\n", xPortGetCoreID());
+
+	session* s;
+	while(s_work->take())
+	{
+		if(!s_jobs->pop(s)) continue;
+
+		serve(s);
+
+		s_done->push(s);
+		s_transport->wake();
+	}
 }
 
-void jsl_http::dispatch(req& _request, res& _response)
+void jsl_http::process(session* _session)
 {
-	ESP_LOGI(SERVER_LOGTAG,"[%s] Dispatch URI [%s]",_request.method().c_str(),_request.uri().c_str());
-	jsl_router::target_t target = m_router.dispatch(_request.method(),_request.path(),_request.args());
+	if(_session->m_busy || _session->sending()) return; // picked up again once done
 
-	if(target == nullptr)
+	bool full = _session->receive();
+
+	while(true) // pipelined requests are served in order, one at a time
 	{
-		ESP_LOGW(SERVER_LOGTAG,"[%s] Target NOT FOUND",_request.method().c_str());
-		_response.write_error(jsl_http_common::STATUS_NOT_FOUND);
-		return;
-	}
+		if(full && _session->m_data.size() <= s_config.max_request) // served requests made room for the rest
+		{
+			full = _session->receive();
+		}
 
-	ESP_LOGD(SERVER_LOGTAG,"Dispatch - Executing target");
-	target(_request,_response);
-}
+		if(_session->m_stream != nullptr) // the body goes to an upload handler, not m_data
+		{
+			if(!_session->m_stream->complete())
+			{
+				if(_session->m_eof)
+				{
+					close(_session);
+				}
+				return;
+			}
+
+			_session->m_length = 0; // the head was moved out of m_data
+		}
+		else
+		{
+			jsl_parser::result_t result = _session->m_parser.feed(_session->m_data.data(), _session->m_data.size());
+			if(result == jsl_parser::PARSE_ERROR)
+			{
+				reject(_session,jsl_http_common::STATUS_BAD_REQUEST);
+				return;
+			}
+
+			if(!_session->m_probed && _session->m_parser.headed() && upload(_session))
+			{
+				continue;
+			}
 
+			// what would have to be buffered, the head so far or the whole request
+			const jsl_parser& parser = _session->m_parser;
+			size_t need = parser.headed() ? parser.body().m_off + parser.body().m_len : _session->m_data.size();
+			if(need > s_config.max_request)
+			{
+				reject(_session,parser.headed() ? jsl_http_common::STATUS_PAYLOAD_TOO_LARGE : jsl_http_common::STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE);
+				return;
+			}
 
+			if(result == jsl_parser::PARSE_MORE)
+			{
+				if(_session->m_eof)
+				{
+					close(_session);
+				}
+				return;
+			}
 
-err_t jsl_http::req::parse()
-{
-	err_t ret;
+			_session->m_length = _session->m_parser.length();
+		}
+
+		if(s_jobs != nullptr && s_jobs->push(_session))
+		{
+			_session->m_busy = true;
+			s_transport->watch(_session->m_conn, 0);
+			s_work->give();
+			return;
+		}
 
-	// Pull request data
+		serve(_session);
+		if(!output(_session) || !finish(_session)) return;
+	}
+}
+
+bool jsl_http::upload(session* _session)
+{
+	_session->m_probed = true;
 
-	netbuf *inbuf = nullptr;
-	ret = netconn_recv(m_conn, &inbuf);
-	if (ret != ERR_OK) return ret;
+	const jsl_parser& parser = _session->m_parser;
+	size_t body = parser.body().m_off;
+	if(s_uploads.empty() || parser.body().m_len == 0) return false;
 
-	std::stringstream stream;
-	do
+	stream* s = new stream(_session->m_data.data(), body, parser, &_session->m_arena);
+	auto u = s_uploads.find(route(s->m_req.method_id(),s->m_req));
+	if(u == s_uploads.end() || !s->m_mpart.boundary(s->m_req.header("Content-Type")))
 	{
-		char *bufptr;
-		u16_t buflen;
-		netbuf_data(inbuf, (void**)&bufptr, &buflen);
+		delete s; // plain route, or not multipart : buffered as usual
+		return false;
+	}
 
-		char t = bufptr[buflen-1];
-		bufptr[buflen-1] = '\0';
-		stream << bufptr;
-		bufptr[buflen-1] = t;
+	s->m_handler = u->second(s->m_req);
+	if(s->m_handler != nullptr)
+	{
+		s->m_mpart.setHandler(s->m_handler);
+		s->m_req.upload(s->m_handler);
+	}
+	else
+	{
+		s->m_failed = true; // refused, the body is dropped and the target answers
 	}
-	while (netbuf_next(inbuf) == 0);
 
-	netbuf_delete(inbuf);
+	ESP_LOGI(SERVER_LOGTAG,"Streaming %u bytes upload",(unsigned)parser.body().m_len);
 
-	ESP_LOGI(SERVER_LOGTAG,"%s",stream.str().c_str());
+	_session->m_stream = s;
+	size_t len = s->feed(_session->m_data.data() + body, _session->m_data.size() - body);
+	_session->m_data.erase(0,body + len); // what's left is read ahead
+	return true;
+}
 
-	// Parse URI and headers
+void jsl_http::serve(session* _session)
+{
+	if(_session->m_stream != nullptr)
+	{
+		serve(_session,_session->m_stream->m_req);
+		return;
+	}
 
-	parse_head(stream);
+	req request(_session->m_data.data(), _session->m_parser, &_session->m_arena); // slices _session->m_data
+	serve(_session,request);
+}
 
-	// Parse request body
+void jsl_http::serve(session* _session, req& _request)
+{
+	res response(*_session, &_request);
 
-	parse_body(stream);
+	_session->m_keep = _request.keepalive() && ++_session->m_served < s_config.keepalive_max;
+	if(_session->m_keep)
+	{
+		char alive[32];
+		snprintf(alive, sizeof(alive), "timeout=%u, max=%u",
+			(unsigned)(s_config.keepalive_timeout / 1000),
+			(unsigned)(s_config.keepalive_max - _session->m_served)
+		);
+		response.header("Connection","keep-alive");
+		response.header("Keep-Alive",alive);
+	}
+	else
+	{
+		response.header("Connection","close");
+	}
 
-	// Parse path
+	dispatch(_request,response);
+	response.end();
 
-	size_t p1 = 0, p2 = 0;
+	if(!response.sent() || response.closing()) // nothing tells the client the response is over but the close
+	{
+		_session->m_keep = false;
+	}
+}
 
-	p1 = m_uri.find('?');
-	p2 = m_uri.find('#');
+bool jsl_http::output(session* _session)
+{
+	err_t ret = _session->pump();
+	if(ret == ERR_OK) return true;
 
-	jsl_str::splitv(m_path,m_uri.substr(0,p1),'/');
+	if(ret == ERR_WOULDBLOCK)
+	{
+		s_transport->watch(_session->m_conn, jsl_transport::EVENT_WRITE);
+		return false;
+	}
 
-	stream.clear();
-	stream.str(m_uri.substr(p1 + 1,p2 - p1));
+	ESP_LOGD(SERVER_LOGTAG,"Output failed (%d)",ret);
+	close(_session);
+	return false;
+}
 
-	// Parse url encoded query string
-	parse_nval(m_query,stream,'&','=');
-	for(auto i : m_query) i.second = jsl_str::url_decode(i.second);
+void jsl_http::resume(session* _session)
+{
+	if(!output(_session) || !finish(_session)) return;
 
-	return ERR_OK;
+	s_transport->watch(_session->m_conn, jsl_transport::EVENT_READ);
+	process(_session); // next pipelined request, or data that came in meanwhile
 }
 
-void jsl_http::req::parse_head(std::stringstream& _stream)
+bool jsl_http::finish(session* _session)
 {
-	std::string line, name, val;
-	while(std::getline(_stream, line, '\n'))
+	if(!_session->m_keep)
 	{
-		line.pop_back(); // remove '\r'
+		close(_session);
+		return false;
+	}
 
-		// ESP_LOGI(SERVER_LOGTAG,"Parse Headers Line [%s]",jsl_str::escape(line).c_str());
+	_session->m_data.erase(0,_session->m_length); // keep what was read ahead
+	_session->m_length = 0;
+	_session->m_parser.reset();
+	_session->m_probed = false;
 
-		if(line.size() == 0) // body start
-		{
-			break;
-		}
-		if(m_uri == "") // first line => METHOD + URI + HTTP/?
-		{
-			size_t p1 = 0, p2 = 0;
+	delete _session->m_stream;
+	_session->m_stream = nullptr;
+	_session->m_arena.reset(); // all that the request and response allocated
+	_session->m_seen = jsl_clock::ms();
 
-			p1 = line.find(' ');
-			p2 = line.rfind(' ');
+	return true;
+}
 
-			m_method = line.substr(0,p1);
-			m_uri = line.substr(p1 + 1,p2 - (p1 + 1));
-		}
-		else // headers
+void jsl_http::expire()
+{
+	u32_t now = jsl_clock::ms();
+	for(size_t i = s_sessions.size(); i-- > 0;)
+	{
+		session* s = s_sessions[i];
+		if(!s->m_busy && now - s->m_seen > s_config.keepalive_timeout)
 		{
-			if(jsl_str::split(line,':',name,val))
-			{
-				m_headers[name] = jsl_str::trim(val);
-			}
+			ESP_LOGD(SERVER_LOGTAG,"Closing idle connection");
+			close(s);
 		}
 	}
 }
 
-void jsl_http::req::parse_body(std::stringstream& _stream)
+void jsl_http::close(session* _session)
 {
-	std::string ctype = header("Content-Type");
+	for(auto i = s_sessions.begin(); i != s_sessions.end(); ++i)
+	{
+		if(*i == _session)
+		{
+			s_sessions.erase(i);
+			break;
+		}
+	}
 
-	// ESP_LOGI(SERVER_LOGTAG,"Parse Request BODY [%s]",ctype.c_str());
+	s_transport->close(_session->m_conn);
+	delete _session;
+}
 
-	if(ctype == "application/x-www-form-urlencoded")
+void jsl_http::reject(session* _session, status_t _status)
+{
 	{
-		// ESP_LOGD(SERVER_LOGTAG,"Urlencoded");
-		// Parse url encoded request body
-		parse_nval(m_form,_stream,'&','=');
-		for(auto i : m_form) i.second = jsl_str::url_decode(i.second);
+		res response(*_session);
+		response.header("Connection","close");
+		response.write_error(_status);
 	}
-	else
-	{
-		// ESP_LOGD(SERVER_LOGTAG,"Not urlencoded [%s]\n%s",ctype.c_str(),_stream.str().c_str());
+	_session->m_keep = false;
+	if(output(_session)) close(_session); // else once it's out
+}
 
-		std::string bound;
-		if(jsl_str::split(ctype,';',ctype,bound) && ctype == "multipart/form-data")
-		{
-			// ESP_LOGV(SERVER_LOGTAG,"Found multipart");
-			ctype = bound;
-			jsl_str::split(ctype,'=',ctype,bound);
+esp_err_t jsl_http::stop()
+{
+	return ESP_OK;
+}
 
-			bound = jsl_str::trim(bound,' ');
-			bound = jsl_str::trim(bound,'"');
-			// ESP_LOGV(SERVER_LOGTAG,"Found multipart bound [%s]",bound.c_str());
+void jsl_http::addRoute(const char* _method, const char* _pattern, jsl_router::target_t _target)
+{
+	m_router.addRoute(_method, _pattern, _target);
+}
 
-			parse_mpart(_stream,bound);
-		}
+void jsl_http::addRoute(method_t _method, const char* _pattern, jsl_router::target_t _target)
+{
+	m_router.addRoute(_method, _pattern, _target);
+}
+
+void jsl_http::addRoutes(const jsl_routes& _routes)
+{
+	s_routes = _routes;
+}
+
+void jsl_http::addUpload(const char* _method, const char* _pattern, upload_t _upload, target_t _target)
+{
+	m_router.addRoute(_method, _pattern, _target);
+	s_uploads[_target] = _upload;
+}
+
+void jsl_http::addAssets(const jsl_asset_t* _assets, size_t _count)
+{
+	for(size_t i = 0; i < _count; ++i)
+	{
+		s_assets[_assets[i].m_path] = &_assets[i]; // not routed : the router would have "/" answer every path
 	}
 }
 
-void jsl_http::req::parse_nval(pmap_t& _map, std::stringstream& _stream, char _c, char _e)
+const jsl_asset_t* jsl_http::asset(const req_t& _req)
+{
+	std::string_view path = _req.uri().substr(0,_req.uri().find_first_of("?#"));
+
+	auto a = s_assets.find(path); // exact, "//x" is not "/x"
+	return a != s_assets.end() ? a->second : nullptr;
+}
+
+void jsl_http::addStatic(const char* _prefix, const char* _root)
+{
+	path_t prefix;
+	jsl_http_common::split(prefix,_prefix,'/');
+
+	mount_t mount;
+	mount.m_prefix.assign(prefix.begin(),prefix.end());
+	mount.m_root = _root;
+	while(mount.m_root.size() > 1 && mount.m_root.back() == '/') mount.m_root.pop_back();
+
+	auto i = s_statics.begin();
+	while(i != s_statics.end() && i->m_prefix.size() >= mount.m_prefix.size()) ++i;
+	s_statics.insert(i,mount);
+}
+
+static bool accepts(std::string_view _accept, std::string_view _coding) // listed in Accept-Encoding (or *), q > 0
 {
-	std::string line, name, val;
-	while(std::getline(_stream, line, _c))
+	while(_accept.size())
 	{
-		if(jsl_str::split(line,_e,name,val))
-		{
-			name = jsl_str::trim(name,' ');
-			name = jsl_str::trim(name,'"');
+		size_t comma = _accept.find(',');
+		std::string_view item = _accept.substr(0,comma);
+		_accept.remove_prefix(comma == std::string_view::npos ? _accept.size() : comma + 1);
 
-			val = jsl_str::trim(val,' ');
-			val = jsl_str::trim(val,'"');
+		size_t semi = item.find(';');
+		std::string_view coding = item.substr(0,semi);
+		while(coding.size() && coding.front() == ' ') coding.remove_prefix(1);
+		while(coding.size() && coding.back() == ' ') coding.remove_suffix(1);
 
-			_map[name] = val;
-		}
-		else
+		if(coding != "*" && (coding.size() != _coding.size() || strncasecmp(coding.data(),_coding.data(),_coding.size()) != 0))
 		{
-			line = jsl_str::trim(line,' ');
-			line = jsl_str::trim(line,'"');
-
-			_map[""] = line;
+			continue;
 		}
+
+		size_t q = item.find("q=",semi);
+		return semi == std::string_view::npos || q == std::string_view::npos || strtod(std::string(item.substr(q + 2)).c_str(),nullptr) > 0;
 	}
+	return false;
 }
 
-void jsl_http::req::parse_mpart(std::stringstream& _stream, std::string _boundary)
+static bool is_file(const std::string& _fname)
 {
-	// ESP_LOGI(SERVER_LOGTAG,"Parse multipart [%s]", _boundary.c_str());
+	struct stat st;
+	return stat(_fname.c_str(),&st) == 0 && S_ISREG(st.st_mode);
+}
 
-	_boundary = "--" + _boundary; // bake-in boundary prefix
+static bool send_variant(jsl_http_common::res_t& _res, const std::string& _fname, bool _gzip) // precompressed first
+{
+	std::string gz = _fname + ".gz";
+	bool zipped = _gzip && is_file(gz);
+	if(!zipped && !is_file(_fname)) return false; // no Vary left on whatever answers instead
 
-	pmap_t headers;
-	bool data = false;
-	std::string line, pname, fname, name, val;
-	while(std::getline(_stream, line, '\n'))
-	{
-		line.pop_back(); // remove '\r'
+	_res.header("Vary","Accept-Encoding");
+	if(zipped && _res.send_file(gz.c_str(),jsl_http_common::mime_type(_fname),"gzip")) return true;
+	return _res.send_file(_fname.c_str());
+}
+
+bool jsl_http::statics(const req_t& _req, res_t& _res)
+{
+	if((_req.method_id() != jsl_http_common::METHOD_GET && _req.method_id() != jsl_http_common::METHOD_HEAD) || s_statics.empty()) return false;
 
-		// ESP_LOGV(SERVER_LOGTAG,"Multipart raw line [%s]", line.c_str());
+	bool gzip = accepts(_req.header("Accept-Encoding"),"gzip");
 
-		if(jsl_str::trim(line) == _boundary + "--") // end of form
+	const path_t& path = _req.path();
+	for(auto& m : s_statics)
+	{
+		if(path.size() < m.m_prefix.size() || !std::equal(m.m_prefix.begin(),m.m_prefix.end(),path.begin()))
 		{
-			// ESP_LOGV(SERVER_LOGTAG,"Multipart END");
-			break;
+			continue;
 		}
 
-		if(jsl_str::trim(line) == _boundary) // new field
+		std::string fname = m.m_root;
+		for(size_t i = m.m_prefix.size(); i < path.size(); ++i)
 		{
-			// ESP_LOGV(SERVER_LOGTAG,"Multipart boundary [%s]", _boundary.c_str());
+			if(path[i] == ".." || path[i] == ".") return false; // stay under the root
+			fname += '/';
+			fname += path[i];
+		}
 
-			headers.clear();
-			data = false;
-			pname = "";
-			fname = "";
+		ESP_LOGD(SERVER_LOGTAG,"Static file [%s]",fname.c_str());
 
-			continue;
-		}
+		if(send_variant(_res,fname,gzip)) return true;
+		if(send_variant(_res,fname + "/index.html",gzip)) return true; // a directory
+	}
 
-		if(data == false && line.size() == 0) // end of part header
-		{
-			// ESP_LOGV(SERVER_LOGTAG,"Multipart data start");
-			std::cout << jsl_http_common::dump_pmap("Multipart",headers);
+	return false;
+}
 
-			data = true;
+void jsl_http::dispatch(req& _request, res& _response)
+{
+	ESP_LOGI(SERVER_LOGTAG,"[%.*s] Dispatch URI [%.*s]",(int)_request.method().size(),_request.method().data(),(int)_request.uri().size(),_request.uri().data());
 
-			continue;
+	// an existing file under a static mount comes first, the router would
+	// otherwise settle for any route leading to it ("/{file}" for "/www/a/b")
+	if(statics(_request,_response)) return;
+
+	jsl_http_common::method_t method = _request.method_id();
+	if(method == jsl_http_common::METHOD_MAX)
+	{
+		ESP_LOGW(SERVER_LOGTAG,"[%.*s] Method NOT IMPLEMENTED",(int)_request.method().size(),_request.method().data());
+		_response.write_error(jsl_http_common::STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	jsl_router::target_t target = route(method,_request);
+	if(target == nullptr && method == jsl_http_common::METHOD_HEAD) // served as a GET, res drops the body
+	{
+		target = route(jsl_http_common::METHOD_GET,_request);
+	}
+
+	if(target == nullptr)
+	{
+		const jsl_asset_t* a = asset(_request);
+		if(a != nullptr && (method == jsl_http_common::METHOD_GET || method == jsl_http_common::METHOD_HEAD))
+		{
+			_response.write_asset(*a);
+			return;
 		}
 
-		if(data == false && jsl_str::split(line,':',name,val))
+		// other methods may have a route for that path
+		u8_t allowed = m_router.allowed(_request.path()) | s_routes.allowed(_request.path());
+		if(a != nullptr) allowed |= 1 << jsl_http_common::METHOD_GET;
+		if(allowed == 0)
 		{
-			// ESP_LOGV(SERVER_LOGTAG,"Multipart header line\n\t%s",line.c_str());
+			ESP_LOGW(SERVER_LOGTAG,"[%.*s] Target NOT FOUND",(int)_request.method().size(),_request.method().data());
+			_response.write_error(jsl_http_common::STATUS_NOT_FOUND);
+			return;
+		}
+
+		if(allowed & (1 << jsl_http_common::METHOD_GET)) allowed |= 1 << jsl_http_common::METHOD_HEAD;
 
-			name = jsl_str::trim(name,' ');
-			name = jsl_str::trim(name,'"');
+		char allow[64] = "";
+		size_t len = 0;
+		for(int m = 0; m < jsl_http_common::METHOD_MAX; ++m)
+		{
+			if(allowed & (1 << m))
+			{
+				len += snprintf(allow + len, sizeof(allow) - len, len ? ", %s" : "%s", jsl_http_common::methods[m]);
+			}
+		}
 
-			val = jsl_str::trim(val,' ');
-			val = jsl_str::trim(val,'"');
+		ESP_LOGW(SERVER_LOGTAG,"[%.*s] Method NOT ALLOWED (%s)",(int)_request.method().size(),_request.method().data(),allow);
+		_response.header("Allow",allow);
+		_response.write_error(jsl_http_common::STATUS_METHOD_NOT_ALLOWED);
+		return;
+	}
 
-			headers[name] = val;
+	ESP_LOGD(SERVER_LOGTAG,"Dispatch - Executing target");
+	target(_request,_response);
+}
 
-			if(
-				name == "Content-Disposition"
-			){
-				// parse directives
+jsl_http::target_t jsl_http::route(method_t _method, req& _request)
+{
+	target_t target = s_routes.dispatch(_method,_request.path(),_request.args());
+	return target != nullptr ? target : m_router.dispatch(_method,_request.path(),_request.args());
+}
 
-				pmap_t pval;
-				std::stringstream sval(val);
-				parse_nval(pval,sval,';','=');
 
-				pname = pval["name"];
-				fname = pval["filename"];
 
-				if(pval.find("filename*") != pval.end())
-				{
-					fname = pval["filename*"];
-				}
+bool jsl_http::session::receive()
+{
+	char buf[1460];
+	size_t len;
+	err_t ret;
+	while(m_data.size() <= s_config.max_request) // past it the request is refused, no need to hold more
+	{
+		if((ret = m_conn->recv(buf, sizeof(buf), len)) != ERR_OK)
+		{
+			if(ret != ERR_WOULDBLOCK) // eof, reset...
+			{
+				m_eof = true;
 			}
+			return false;
+		}
+
+		size_t body = m_stream != nullptr ? m_stream->feed(buf, len) : 0; // upload bytes never hit m_data
+		m_data.append(buf + body, len - body);
+		m_seen = jsl_clock::ms();
+	}
+	return true;
+}
+
+jsl_http::session::~session()
+{
+	delete m_stream;
+	if(m_file.m_file != nullptr) fclose(m_file.m_file);
+}
+
+err_t jsl_http::session::send(const jsl_transport::vec_t* _vec, int _count, bool _copy)
+{
+	size_t sent = 0;
+	if(m_out.empty()) // else it would overtake what is queued
+	{
+		err_t ret = m_conn->send(_vec, _count, sent, _copy);
+		if(ret != ERR_OK) return ret;
+		if(sent > 0) m_seen = jsl_clock::ms();
+	}
 
+	for(int i = 0; i < _count; ++i) // the rest waits for the connection
+	{
+		if(sent >= _vec[i].m_len)
+		{
+			sent -= _vec[i].m_len;
 			continue;
 		}
 
-		if(data == true)
+		const char* data = (const char*)_vec[i].m_data + sent;
+		size_t len = _vec[i].m_len - sent;
+		sent = 0;
+		if(_copy)
+		{
+			m_out.push_back(out_t{std::string(data, len), nullptr, len, 0});
+			m_queued += len;
+		}
+		else
 		{
-			// ESP_LOGV(SERVER_LOGTAG,"Multipart form line [%s]\n\t%s",pname.c_str(),line.c_str());
-			m_form[pname] += line;
+			m_out.push_back(out_t{std::string(), data, len, 0});
 		}
 	}
+	return ERR_OK;
 }
 
-std::string jsl_http::res::headers()
+err_t jsl_http::session::flush()
 {
-	std::string ret;
-	for(auto i = m_headers.begin(); i != m_headers.end(); ++i)
+	while(m_out.size())
 	{
-		ret += i->first + ": " + i->second + "\n";
+		// pieces alike gathered, copied ones are copied again by the stack
+		jsl_transport::vec_t vec[GATHER];
+		bool copy = m_out.front().m_data == nullptr;
+		int count = 0;
+		size_t len = 0;
+		for(auto i = m_out.begin(); i != m_out.end() && count < GATHER && (i->m_data == nullptr) == copy; ++i, ++count)
+		{
+			vec[count] = { (copy ? i->m_copy.data() : i->m_data) + i->m_off, i->m_len - i->m_off };
+			len += vec[count].m_len;
+		}
+
+		size_t sent;
+		err_t ret = m_conn->send(vec, count, sent, copy);
+		if(ret != ERR_OK) return ret;
+		if(sent > 0) m_seen = jsl_clock::ms();
+
+		bool full = sent < len;
+		while(sent > 0)
+		{
+			out_t& o = m_out.front();
+			size_t part = std::min(sent, o.m_len - o.m_off);
+			o.m_off += part;
+			sent -= part;
+			if(o.m_off < o.m_len) break;
+
+			if(copy) m_queued -= o.m_len;
+			m_out.pop_front();
+		}
+
+		if(full) return ERR_WOULDBLOCK;
 	}
-	return ret;
+	return ERR_OK;
 }
 
-void jsl_http::res::write(status_t _status)
+err_t jsl_http::session::drain()
 {
-	if(_status >= jsl_http_common::STATUS_MAX) return; // invalid status
+	while(m_out.size())
+	{
+		out_t& o = m_out.front();
+		bool copy = o.m_data == nullptr;
+		err_t ret = m_conn->write((copy ? o.m_copy.data() : o.m_data) + o.m_off, o.m_len - o.m_off, copy);
+		if(ret != ERR_OK) return ret;
 
-	u32_t clength;
-	std::ostringstream headr;
-
-	// Compute Content-Length
-	headr << (clength = size());
-	m_headers["Content-Length"] = headr.str();
-	// Reset stream
-	headr.str(std::string());
-	headr.clear();
-	// Build response headers
-	jsl_http_common::statinfo_t status = jsl_http_common::statcm[_status];
-	headr << "HTTP/1.1 " << status.code << " " << status.msg << "\n" << headers() << "\n";
-	// Compute stream length
-	headr.seekp(0, std::ios::end);
-	u32_t hlength = headr.tellp();
-	// Flush to netconn
-	netconn_write(m_conn, headr.str().c_str(), hlength, NETCONN_COPY );
-	netconn_write(m_conn, m_out.str().c_str(), clength, NETCONN_COPY );
+		if(copy) m_queued -= o.m_len;
+		m_out.pop_front();
+	}
+	m_seen = jsl_clock::ms();
+	return ERR_OK;
+}
+
+err_t jsl_http::session::pump()
+{
+	size_t budget = PUMP;
+	while(true)
+	{
+		err_t ret = flush();
+		if(ret != ERR_OK || m_file.m_file == nullptr) return ret;
+		if(budget == 0) return ERR_WOULDBLOCK; // the others' turn, the connection still reports room
+
+		file_t& f = m_file;
+		char buf[FILE_CHUNK];
+		if(f.m_off == f.m_end) // next range, or the end
+		{
+			int len = 0;
+			if(f.m_next == f.m_count)
+			{
+				fclose(f.m_file);
+				f.m_file = nullptr;
+				if(f.m_bound[0]) len = snprintf(buf, sizeof(buf), "\r\n--%s--\r\n", f.m_bound);
+			}
+			else
+			{
+				const range_t& r = f.m_ranges[f.m_next++];
+				if(fseek(f.m_file, r.m_first, SEEK_SET) != 0) return ERR_ABRT;
+				f.m_off = r.m_first;
+				f.m_end = r.m_last + 1;
+				if(f.m_bound[0]) len = snprintf(buf, sizeof(buf), "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lu-%lu/%lu\r\n\r\n",
+					f.m_bound, f.m_type.c_str(), (unsigned long)r.m_first, (unsigned long)r.m_last, (unsigned long)f.m_size);
+			}
+
+			jsl_transport::vec_t vec = { buf, (size_t)len };
+			if(len > 0 && (ret = send(&vec, 1)) != ERR_OK) return ret;
+			continue;
+		}
+
+		size_t len = fread(buf, 1, std::min(sizeof(buf), f.m_end - f.m_off), f.m_file);
+		if(len == 0) // short body, only the close can tell the client
+		{
+			ESP_LOGW(SERVER_LOGTAG,"File cut short");
+			return ERR_ABRT;
+		}
+		f.m_off += len;
+		budget -= std::min(budget, len);
+
+		jsl_transport::vec_t vec = { buf, len };
+		if((ret = send(&vec, 1)) != ERR_OK) return ret;
+	}
+}
+
+jsl_http::stream::stream(const char* _head, size_t _len, const jsl_parser& _parser, jsl_arena* _arena) :
+	m_head(_head, _len),
+	m_req(m_head.data(), _parser, _arena, false),
+	m_handler(nullptr),
+	m_left(_parser.body().m_len),
+	m_failed(false)
+{
+}
+
+jsl_http::stream::~stream()
+{
+	if(m_handler != nullptr)
+	{
+		if(!complete()) m_handler->close(false); // connection lost mid body
+		delete m_handler;
+	}
+}
+
+size_t jsl_http::stream::feed(const char* _data, size_t _len)
+{
+	size_t len = std::min(_len, m_left);
+	if(len == 0) return 0;
+
+	m_left -= len;
+	if(!m_failed && m_mpart.feed(_data, len) == jsl_multipart::MPART_ERROR)
+	{
+		m_failed = true;
+	}
+
+	if(complete() && m_handler != nullptr)
+	{
+		m_handler->close(!m_failed && m_mpart.done());
+	}
+	return len;
+}
+
+static std::string_view trim(std::string_view _str, char _c)
+{
+	while(_str.size() && _str.front() == _c) _str.remove_prefix(1);
+	while(_str.size() && _str.back() == _c) _str.remove_suffix(1);
+	return _str;
+}
+
+static inline int unhex(char _c)
+{
+	if(_c >= '0' && _c <= '9') return _c - '0';
+	if(_c >= 'a' && _c <= 'f') return _c - 'a' + 10;
+	if(_c >= 'A' && _c <= 'F') return _c - 'A' + 10;
+	return -1;
+}
+
+static std::string_view decode(char* _str, size_t _len) // url decoding only ever shrinks, done in place
+{
+	char* out = _str;
+	for(size_t i = 0; i < _len; ++i)
+	{
+		char c = _str[i];
+		if(c == '+')
+		{
+			c = ' ';
+		}
+		else if(c == '%' && i + 2 < _len && unhex(_str[i + 1]) >= 0 && unhex(_str[i + 2]) >= 0)
+		{
+			c = (char)(unhex(_str[i + 1]) << 4 | unhex(_str[i + 2]));
+			i += 2;
+		}
+		*out++ = c;
+	}
+	return std::string_view(_str, out - _str);
+}
+
+class form_collector : // collects buffered multipart parts into req_t::form()
+	public jsl_multipart::handler
+{
+public:
+
+	form_collector(jsl_http_common::vmap_t& _form) : m_form(_form), m_data(nullptr), m_len(0) {}
+
+	virtual bool part(const jsl_multipart::part_t& _part)
+	{
+		m_name = _part.m_name;
+		m_data = nullptr;
+		m_len = 0;
+		return true;
+	}
+
+	virtual bool data(const char* _data, size_t _len)
+	{
+		if(m_data == nullptr) m_data = _data;
+		m_len += _len;
+		return m_data + m_len == _data + _len; // contiguous, fed from a single buffer
+	}
+
+	virtual bool end()
+	{
+		m_form.set(m_name,std::string_view(m_data != nullptr ? m_data : "",m_len));
+		return true;
+	}
+
+protected:
+
+	jsl_http_common::vmap_t& m_form;
+	std::string_view m_name;
+	const char* m_data;
+	size_t m_len;
+};
+
+err_t jsl_http::req::parse(char* _data, const jsl_parser& _parser, bool _body)
+{
+	// Request line and headers
+
+	m_method = std::string_view(_data + _parser.method().m_off, _parser.method().m_len);
+	m_method_id = jsl_http_common::parse_method(m_method); // once, routes are looked up by it
+	m_uri = std::string_view(_data + _parser.uri().m_off, _parser.uri().m_len);
+	m_version = std::string_view(_data + _parser.version().m_off, _parser.version().m_len);
+
+	for(auto& f : _parser.headers())
+	{
+		m_headers.set(
+			std::string_view(_data + f.m_name.m_off, f.m_name.m_len),
+			std::string_view(_data + f.m_value.m_off, f.m_value.m_len)
+		);
+	}
+
+	ESP_LOGI(SERVER_LOGTAG,"[%.*s] %.*s",(int)m_method.size(),m_method.data(),(int)m_uri.size(),m_uri.data());
+
+	// Parse request body, unless it's not in yet (streamed)
+
+	if(_body)
+	{
+		parse_body(_data + _parser.body().m_off, _parser.body().m_len);
+	}
+
+	// Parse path
+
+	size_t q = m_uri.find('?');
+	size_t h = m_uri.find('#');
+
+	jsl_http_common::split(m_path,m_uri.substr(0,q < h ? q : h),'/');
+
+	// Parse url encoded query string
+
+	if(q < h)
+	{
+		char* query = _data + _parser.uri().m_off + q + 1;
+		size_t end = h == std::string_view::npos ? m_uri.size() : h;
+		parse_nval(m_query,query,end - (q + 1),'&','=',true);
+	}
+
+	return ERR_OK;
+}
+
+void jsl_http::req::parse_body(char* _body, size_t _len)
+{
+	std::string_view ctype = header("Content-Type");
+
+	// ESP_LOGI(SERVER_LOGTAG,"Parse Request BODY [%.*s]",(int)ctype.size(),ctype.data());
+
+	if(ctype.substr(0,33) == "application/x-www-form-urlencoded")
+	{
+		// ESP_LOGD(SERVER_LOGTAG,"Urlencoded");
+		// Parse url encoded request body
+		parse_nval(m_form,_body,_len,'&','=',true);
+	}
+	else if(ctype.substr(0,19) == "multipart/form-data")
+	{
+		// ESP_LOGV(SERVER_LOGTAG,"Found multipart");
+		// Buffered multipart : fed at once, so names and data slice _body
+		form_collector collect(m_form);
+		jsl_multipart mpart(&collect);
+		if(mpart.boundary(ctype))
+		{
+			mpart.feed(_body,_len);
+		}
+	}
+}
+
+void jsl_http::req::parse_nval(vmap_t& _map, char* _data, size_t _len, char _c, char _e, bool _decode)
+{
+	char* end = _data + _len;
+	while(_data < end)
+	{
+		char* next = (char*)memchr(_data,_c,end - _data);
+		if(next == nullptr) next = end;
+
+		char* eq = (char*)memchr(_data,_e,next - _data);
+		if(eq != nullptr)
+		{
+			std::string_view name = _decode ? decode(_data,eq - _data) : std::string_view(_data,eq - _data);
+			std::string_view val = _decode ? decode(eq + 1,next - (eq + 1)) : std::string_view(eq + 1,next - (eq + 1));
+
+			_map.set(trim(trim(name,' '),'"'),trim(trim(val,' '),'"'));
+		}
+		else if(next > _data)
+		{
+			std::string_view line = _decode ? decode(_data,next - _data) : std::string_view(_data,next - _data);
+
+			_map.set("",trim(trim(line,' '),'"'));
+		}
+
+		_data = next + 1;
+	}
+}
+
+bool jsl_http::req::keepalive() const
+{
+	std::string_view conn = header("Connection");
+	if(m_version == "HTTP/1.0")
+	{
+		return conn.size() >= 10 && strncasecmp(conn.data(),"keep-alive",10) == 0;
+	}
+	return !(conn.size() >= 5 && strncasecmp(conn.data(),"close",5) == 0); // HTTP/1.1 persists by default
+}
+
+jsl_http::res::res(session& _session, const req* _req) :
+	res_t(&_session.m_arena),
+	m_session(&_session),
+	m_req(_req),
+	m_head(_session.m_head),
+	m_chunks(nullptr),
+	m_sent(false),
+	m_chunked(_req == nullptr || _req->version() != "HTTP/1.0"),
+	m_nobody(_req != nullptr && _req->method_id() == jsl_http_common::METHOD_HEAD),
+	m_close(false)
+{
+}
+
+static bool matches(std::string_view _list, std::string_view _etag) // If-None-Match, weak comparison
+{
+	if(_etag.size() > 2 && _etag.substr(0,2) == "W/") _etag.remove_prefix(2);
+
+	while(_list.size())
+	{
+		size_t comma = _list.find(',');
+		std::string_view tag = _list.substr(0,comma);
+		_list.remove_prefix(comma == std::string_view::npos ? _list.size() : comma + 1);
+
+		while(tag.size() && tag.front() == ' ') tag.remove_prefix(1);
+		while(tag.size() && tag.back() == ' ') tag.remove_suffix(1);
+		if(tag.size() > 2 && tag.substr(0,2) == "W/") tag.remove_prefix(2);
+
+		if(tag == "*" || tag == _etag) return true;
+	}
+	return false;
+}
+
+bool jsl_http::res::fresh(std::string_view _etag, std::string_view _modified) const
+{
+	if(m_req == nullptr || (m_req->method_id() != jsl_http_common::METHOD_GET && m_req->method_id() != jsl_http_common::METHOD_HEAD)) return false;
+
+	std::string_view inm = m_req->header("If-None-Match");
+	if(inm.size()) // takes precedence
+	{
+		return _etag.size() && matches(inm,_etag);
+	}
+
+	// clients send back the Last-Modified they got, verbatim
+	std::string_view ims = m_req->header("If-Modified-Since");
+	return ims.size() && ims == _modified;
+}
+
+size_t jsl_http::res::render(status_t _status)
+{
+	const jsl_http_common::statinfo_t& status = jsl_http_common::statcm[_status];
+
+	size_t need = status.len + 2; // the blank line
+	for(auto i = m_headers.begin(); i != m_headers.end(); ++i)
+	{
+		need += i->first.size() + i->second.size() + 4;
+	}
+	if(need > HEAD) // long headers, this response gets a buffer from the arena
+	{
+		char* head = (char*)m_arena->alloc(need, 1);
+		if(head == nullptr) // out of memory, none may be left out (Content-Length...) : a bare 500 and the close
+		{
+			ESP_LOGE(SERVER_LOGTAG,"Headers overflow (%u bytes)",(unsigned)need);
+			static const char fail[] = "HTTP/1.1 500 Internal Server Error\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+			jsl_transport::vec_t vec = { fail, sizeof(fail) - 1 };
+			send(&vec, 1, false);
+			m_sent = true;
+			m_close = true;
+			return 0;
+		}
+		m_head = head;
+	}
+
+	memcpy(m_head, status.line, status.len);
+	size_t len = status.len;
+
+	for(auto i = m_headers.begin(); i != m_headers.end(); ++i)
+	{
+		size_t nlen = i->first.size();
+		size_t vlen = i->second.size();
+		memcpy(m_head + len, i->first.data(), nlen);
+		len += nlen;
+		memcpy(m_head + len, ": ", 2);
+		len += 2;
+		memcpy(m_head + len, i->second.data(), vlen);
+		len += vlen;
+		memcpy(m_head + len, "\r\n", 2);
+		len += 2;
+	}
+	memcpy(m_head + len, "\r\n", 2);
+	return len + 2;
+}
+
+bool jsl_http::res::head(status_t _status)
+{
+	size_t len = render(_status);
+	return len > 0 && send(m_head, len);
+}
+
+bool jsl_http::res::send(const jsl_transport::vec_t* _vec, int _count, bool _copy)
+{
+	if(m_session->send(_vec, _count, _copy) != ERR_OK) // cut short, only the close can tell the client
+	{
+		m_close = true;
+		return false;
+	}
+	return true;
+}
+
+bool jsl_http::res::send(const void* _data, size_t _len)
+{
+	jsl_transport::vec_t vec = { _data, _len };
+	return send(&vec, 1);
+}
+
+void jsl_http::res::write(status_t _status)
+{
+	if(m_chunks != nullptr) // streaming, the status is out already
+	{
+		end();
+		return;
+	}
+
+	if(_status >= jsl_http_common::STATUS_MAX) return; // invalid status
+
+	if(_status == jsl_http_common::STATUS_OK && fresh(header("ETag"),header("Last-Modified")))
+	{
+		head(jsl_http_common::STATUS_NOT_MODIFIED);
+		m_sent = true;
+		return;
+	}
+
+	header("Content-Length",std::to_string(size()));
+
+	size_t len = render(_status);
+	if(len == 0) return;
+	m_sent = true;
+
+	// head and body chunks gathered : a small response leaves in a single segment
+	jsl_transport::vec_t vec[GATHER];
+	int count = 0;
+	vec[count++] = { m_head, len };
+	for(const jsl_body::chunk_t* c = m_nobody ? nullptr : m_body.chunks(); c != nullptr; c = c->m_next)
+	{
+		if(count == GATHER)
+		{
+			if(!send(vec, count)) return;
+			count = 0;
+		}
+		vec[count++] = { c->m_data, c->m_len };
+	}
+	send(vec, count); // the head or the last chunks
+}
+
+void jsl_http::res::write_asset(const jsl_asset_t& _asset)
+{
+	if(m_sent) return;
+
+	// there is no plain copy in flash, so gzip or nothing
+	if(_asset.m_gzip && (m_req == nullptr || !accepts(m_req->header("Accept-Encoding"),"gzip")))
+	{
+		header("Vary","Accept-Encoding");
+		write_error(jsl_http_common::STATUS_NOT_ACCEPTABLE);
+		return;
+	}
+
+	// a 304 may carry the very same headers, Content-Length included
+	bool unchanged = fresh(_asset.m_etag,"");
+
+	// status line and connection headers, the asset brings its own
+	size_t len = render(unchanged ? jsl_http_common::STATUS_NOT_MODIFIED : jsl_http_common::STATUS_OK);
+	if(len == 0) return;
+	m_sent = true;
+
+	// both flash resident
+	jsl_transport::vec_t vec[2] = {
+		{ _asset.m_head, _asset.m_hlen },
+		{ _asset.m_data, !unchanged && !m_nobody ? _asset.m_len : 0 }
+	};
+	if(send(m_head, len - 2))
+	{
+		send(vec, 2, false);
+	}
+}
+
+static bool number(std::string_view _str, size_t& _val)
+{
+	if(_str.empty() || _str.size() > 18) return false;
+	_val = 0;
+	for(char c : _str)
+	{
+		if(c < '0' || c > '9') return false;
+		_val = _val * 10 + (c - '0');
+	}
+	return true;
+}
+
+int jsl_http::parse_ranges(std::string_view _spec, size_t _size, range_t* _ranges, int _max)
+{
+	if(_spec.substr(0,6) != "bytes=") return -1;
+	_spec.remove_prefix(6);
+
+	int count = 0;
+	while(_spec.size())
+	{
+		size_t comma = _spec.find(',');
+		std::string_view item = _spec.substr(0,comma);
+		_spec.remove_prefix(comma == std::string_view::npos ? _spec.size() : comma + 1);
+
+		while(item.size() && item.front() == ' ') item.remove_prefix(1);
+		while(item.size() && item.back() == ' ') item.remove_suffix(1);
+		if(item.empty()) continue;
+
+		size_t dash = item.find('-');
+		if(dash == std::string_view::npos) return -1;
+
+		size_t first, last;
+		if(dash == 0) // suffix : the last n bytes
+		{
+			if(!number(item.substr(1),last)) return -1;
+			if(last == 0 || _size == 0) continue;
+			first = last >= _size ? 0 : _size - last;
+			last = _size - 1;
+		}
+		else
+		{
+			if(!number(item.substr(0,dash),first)) return -1;
+			if(dash + 1 == item.size()) last = _size - 1; // open ended
+			else if(!number(item.substr(dash + 1),last) || last < first) return -1;
+			if(first >= _size) continue;
+			if(last >= _size) last = _size - 1;
+		}
+
+		if(count == _max) return -1;
+		_ranges[count++] = range_t{first,last};
+	}
+	return count;
+}
+
+bool jsl_http::res::send_file(const char* _path, const char* _type, const char* _encoding)
+{
+	if(m_sent) return false;
+
+	struct stat st;
+	if(stat(_path, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+	size_t size = st.st_size;
+
+	// validators from the metadata : mtime and size
+	char etag[40];
+	snprintf(etag, sizeof(etag), "\"%lx-%lx\"", (unsigned long)st.st_mtime, (unsigned long)size);
+	char modified[32] = "";
+	if(st.st_mtime > 0) // SPIFFS may not keep it
+	{
+		struct tm tm;
+		gmtime_r(&st.st_mtime, &tm);
+		strftime(modified, sizeof(modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+		header("Last-Modified",modified);
+	}
+	const char* type = _type != nullptr ? _type : jsl_http_common::mime_type(_path);
+	header("ETag",etag);
+	header("Content-type",type);
+	header("Accept-Ranges","bytes");
+	if(_encoding != nullptr)
+	{
+		header("Content-Encoding",_encoding);
+	}
+
+	if(fresh(etag, modified)) // before the file is even opened
+	{
+		head(jsl_http_common::STATUS_NOT_MODIFIED);
+		m_sent = true;
+		return true;
+	}
+
+	// Byte ranges, unless If-Range says the client's copy is another version
+	range_t ranges[MAX_RANGES];
+	int count = -1;
+	std::string_view range = m_req != nullptr && m_req->method_id() == jsl_http_common::METHOD_GET ? m_req->header("Range") : std::string_view();
+	std::string_view ifrange = m_req != nullptr ? m_req->header("If-Range") : std::string_view();
+	if(range.size() && (ifrange.empty() || ifrange == etag || (*modified && ifrange == modified)))
+	{
+		count = parse_ranges(range, size, ranges, MAX_RANGES);
+	}
+
+	char crange[64];
+	if(count == 0)
+	{
+		snprintf(crange, sizeof(crange), "bytes */%lu", (unsigned long)size);
+		header("Content-Range",crange);
+		header("Content-Length","0");
+		head(jsl_http_common::STATUS_RANGE_NOT_SATISFIABLE);
+		m_sent = true;
+		return true;
+	}
+
+	FILE* file = m_nobody ? nullptr : fopen(_path, "rb");
+	if(!m_nobody && file == nullptr)
+	{
+		for(const char* h : {"Last-Modified","ETag","Content-type","Accept-Ranges","Content-Encoding","Vary"})
+		{
+			m_headers.ierase(h); // left to whatever answers instead
+		}
+		return false;
+	}
+
+	// the body is left to the session, read as the connection takes it
+	file_t& f = m_session->m_file;
+	f.m_count = f.m_next = 0;
+	f.m_off = f.m_end = 0;
+	f.m_size = size;
+	f.m_bound[0] = 0;
+
+	if(count < 0) // whole file
+	{
+		header("Content-Length",std::to_string(size));
+		head(jsl_http_common::STATUS_OK);
+		if(size > 0) f.m_ranges[f.m_count++] = range_t{0, size - 1};
+	}
+	else if(count == 1)
+	{
+		snprintf(crange, sizeof(crange), "bytes %lu-%lu/%lu", (unsigned long)ranges[0].m_first, (unsigned long)ranges[0].m_last, (unsigned long)size);
+		header("Content-Range",crange);
+		header("Content-Length",std::to_string(ranges[0].m_last - ranges[0].m_first + 1));
+		head(jsl_http_common::STATUS_PARTIAL_CONTENT);
+		f.m_ranges[f.m_count++] = ranges[0];
+	}
+	else // multipart/byteranges, each part headed by its range
+	{
+		snprintf(f.m_bound, sizeof(f.m_bound), "jsl_%lx_%lx", (unsigned long)st.st_mtime, (unsigned long)size);
+
+		char part[256];
+		size_t clength = 0;
+		for(int i = 0; i < count; ++i)
+		{
+			clength += snprintf(part, sizeof(part), "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lu-%lu/%lu\r\n\r\n",
+				f.m_bound, type, (unsigned long)ranges[i].m_first, (unsigned long)ranges[i].m_last, (unsigned long)size);
+			clength += ranges[i].m_last - ranges[i].m_first + 1;
+			f.m_ranges[f.m_count++] = ranges[i];
+		}
+		clength += snprintf(part, sizeof(part), "\r\n--%s--\r\n", f.m_bound);
+		f.m_type = type;
+
+		header("Content-type",std::string("multipart/byteranges; boundary=") + f.m_bound);
+		header("Content-Length",std::to_string(clength));
+		head(jsl_http_common::STATUS_PARTIAL_CONTENT);
+	}
+	m_sent = true;
+
+	if(file == nullptr) return true; // HEAD
+
+	if(f.m_count == 0 || m_close) // empty, or the connection failed
+	{
+		fclose(file);
+		return true;
+	}
+	f.m_file = file;
+	return true;
+}
+
+void jsl_http::res::stream(status_t _status)
+{
+	if(m_sent || _status >= jsl_http_common::STATUS_MAX) return;
+
+	if(m_chunked)
+	{
+		header("Transfer-Encoding","chunked");
+	}
+	else // HTTP/1.0 : the close ends the body
+	{
+		header("Connection","close");
+		m_headers.ierase("Keep-Alive");
+		m_close = true;
+	}
+
+	head(_status);
+	m_sent = true;
+
+	m_chunks = new chunker(*this);
+	static_cast<std::ios&>(m_out).rdbuf(m_chunks);
+	for(const jsl_body::chunk_t* c = m_body.chunks(); c != nullptr; c = c->m_next) // written before the switch
+	{
+		m_out.write(c->m_data, c->m_len);
+	}
+	m_body.clear();
+}
+
+void jsl_http::res::end()
+{
+	if(m_chunks != nullptr)
+	{
+		m_chunks->close();
+	}
+}
+
+jsl_http::res::chunker::chunker(res& _res) : m_res(_res), m_closed(false)
+{
+	setp(m_buf + FRAME, m_buf + FRAME + CHUNK);
+}
+
+int jsl_http::res::chunker::flush()
+{
+	if(m_closed) return -1;
+
+	char* data = pbase();
+	size_t len = pptr() - pbase();
+	if(len == 0) return 0;
+
+	if(m_res.m_nobody) // HEAD
+	{
+		setp(m_buf + FRAME, m_buf + FRAME + CHUNK);
+		return 0;
+	}
+
+	if(m_res.m_chunked) // frame it in place : hex size CRLF data CRLF
+	{
+		char size[FRAME + 1];
+		int slen = snprintf(size, sizeof(size), "%x\r\n", (unsigned)len);
+		data -= slen;
+		memcpy(data, size, slen);
+		memcpy(pptr(), "\r\n", 2);
+		len += slen + 2;
+	}
+
+	setp(m_buf + FRAME, m_buf + FRAME + CHUNK);
+
+	// queued as the rest, a stream outrunning the client writes through instead of piling up
+	session& s = *m_res.m_session;
+	if(!m_res.send(data, len) || (s.m_queued > OUT_QUEUE && s.drain() != ERR_OK))
+	{
+		ESP_LOGW(SERVER_LOGTAG,"Stream write failed");
+		m_res.m_close = true;
+		m_closed = true;
+		return -1;
+	}
+	return 0;
+}
+
+void jsl_http::res::chunker::close()
+{
+	if(m_closed) return;
+
+	if(flush() == 0 && m_res.m_chunked && !m_res.m_nobody)
+	{
+		m_res.send("0\r\n\r\n", 5);
+	}
+
+	m_closed = true;
+	setp(nullptr, nullptr); // later writes fail
+}
+
+jsl_http::res::chunker::int_type jsl_http::res::chunker::overflow(int_type _c)
+{
+	if(flush() != 0) return traits_type::eof();
+
+	if(!traits_type::eq_int_type(_c, traits_type::eof()))
+	{
+		*pptr() = traits_type::to_char_type(_c);
+		pbump(1);
+	}
+	return traits_type::not_eof(_c);
+}
+
+int jsl_http::res::chunker::sync()
+{
+	return flush();
 }
@@ -27,16 +27,16 @@
 #define JSL_http_H
 
 
-#include <esp_err.h>
-#include <esp_event_loop.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/event_groups.h>
-
-#include <lwip/api.h>
-#include <lwip/err.h>
+#include <deque>
+#include <stdio.h>
 
+#include "jsl-port.h"
 #include "jsl-common.h"
+#include "jsl-parser.h"
+#include "jsl-queue.h"
 #include "jsl-router.h"
+#include "jsl-routes.h"
+#include "jsl-transport.h"
 
 class jsl_http
 {
@@ -46,14 +46,47 @@ public:
 	using res_t = jsl_http_common::res_t;
 	using path_t = jsl_http_common::path_t;
 	using pmap_t = jsl_http_common::pmap_t;
+	using vmap_t = jsl_http_common::vmap_t;
 	using target_t = jsl_http_common::target_t;
+	using upload_t = jsl_http_common::upload_t;
 	using status_t = jsl_http_common::status_t;
+	using method_t = jsl_http_common::method_t;
+
+	using conn_t = jsl_transport::conn;
 
-	static esp_err_t start(const EventGroupHandle_t _evgr = nullptr);
+	typedef struct
+	{
+		u16_t port = 80;
+		u16_t max_conns = 8; // simultaneously open connections
+		u32_t max_request = 16384; // bytes buffered for a single request
+		u16_t body_chunks = 16; // response body pool, jsl_body::CHUNK bytes each
+		u32_t arena_block = 2048; // per connection request arena, grows by blocks of that size
+		bool arena_psram = false; // arena blocks from PSRAM when there is some
+		bool freeze_routes = true; // compile the routes into flat arrays when run() starts
+		u8_t route_cache = 0; // dispatch results kept for the most requested paths, 0 : none
+		u16_t keepalive_max = 100; // requests served per connection, 0 : close after each response
+		u32_t keepalive_timeout = 5000; // ms a connection may stay idle (or mid request)
+		u8_t workers = 0; // dispatching tasks, 0 : dispatch from the run task
+		s8_t worker_core = -1; // pin all workers to one core, -1 : spread them across cores
+		u8_t worker_prio = 5;
+		u32_t worker_stack = 4096;
+	} config_t;
+
+	static void configure(const config_t& _config);
+	static esp_err_t start(const EventGroupHandle_t _evgr = nullptr, jsl_transport* _transport = nullptr);
 	static void run(void* _ctx);
 	static esp_err_t stop();
 
 	static void addRoute(const char* _method, const char* _pattern, target_t _target);
+	static void addRoute(method_t _method, const char* _pattern, target_t _target);
+	// a compile time table (jsl-routes.h), tried before the routes added at runtime
+	static void addRoutes(const jsl_routes& _routes);
+	// multipart bodies are streamed to what _upload returns, _target answers once the body is in
+	static void addUpload(const char* _method, const char* _pattern, upload_t _upload, target_t _target);
+	// every asset of a pack generated by jsl-assets.py, GET at its exact path
+	static void addAssets(const jsl_asset_t* _assets, size_t _count);
+	// GET requests under _prefix are served from the _root directory (VFS) when the file exists
+	static void addStatic(const char* _prefix, const char* _root);
 
 protected:
 
@@ -62,40 +95,213 @@ protected:
 	{
 	public:
 
-		req(netconn& _con) : m_conn(&_con) { parse(); }
-		inline pmap_t& args() { return m_args; } // non const, needed for router dispatch
+		req(char* _data, const jsl_parser& _parser, jsl_arena* _arena = nullptr, bool _body = true) : req_t(_arena) { parse(_data, _parser, _body); } // _data and _arena must outlive the req
+		inline vmap_t& args() { return m_args; } // non const, needed for router dispatch
+		inline void upload(jsl_multipart::handler* _upload) { m_upload = _upload; }
+		inline std::string_view version() const { return m_version; }
+
+		bool keepalive() const; // client wants the connection to persist
 
 	protected:
 
-		err_t parse();
+		err_t parse(char* _data, const jsl_parser& _parser, bool _body);
 
-		void parse_head(std::stringstream& _stream);
-		void parse_body(std::stringstream& _stream);
-		void parse_nval(pmap_t& _map, std::stringstream& _stream, char _c = '&', char _e = '=');
-		void parse_mpart(std::stringstream& _stream, std::string _boundary);
+		void parse_body(char* _body, size_t _len);
+		void parse_nval(vmap_t& _map, char* _data, size_t _len, char _c, char _e, bool _decode); // decodes in place
 
-		netconn* m_conn;
+		std::string_view m_version;
 	};
 
+	class session;
+
 	class res :
 		public res_t
 	{
 	public:
 
-		res(netconn& _con) : m_conn(&_con) {}
+		static constexpr size_t HEAD = 512; // rendered status line and headers
+
+		res(session& _session, const req* _req = nullptr); // _req : conditional and HEAD requests
+		~res() { delete m_chunks; }
+
 		virtual void write(status_t _status);
+		virtual void write_asset(const jsl_asset_t& _asset);
+		virtual bool send_file(const char* _path, const char* _type = nullptr, const char* _encoding = nullptr);
+		virtual void stream(status_t _status);
+		void end(); // terminates a stream, once the target returned
+
+		inline bool sent() const { return m_sent; }
+		inline bool closing() const { return m_close; } // the connection can't persist past this response
 
 	protected:
 
-		std::string headers();
+		class chunker : // fixed buffer, sent as a chunk each time it fills up
+			public std::streambuf
+		{
+		public:
+
+			chunker(res& _res);
+
+			int flush(); // 0, or -1 once the connection failed
+			void close(); // last chunk, nothing goes out after that
+
+		protected:
+
+			virtual int_type overflow(int_type _c);
+			virtual int sync();
+
+			static constexpr size_t CHUNK = 1024;
+			static constexpr size_t FRAME = 10; // room for the hex size line ahead of the data
+
+			res& m_res;
+			bool m_closed;
+			char m_buf[FRAME + CHUNK + 2];
+		};
+
+		size_t render(status_t _status); // status line and headers into m_head, returns the length, 0 if they couldn't be (500 sent)
+		bool head(status_t _status); // renders and sends them, false if the connection failed
+		bool send(const jsl_transport::vec_t* _vec, int _count, bool _copy = true); // through the session, false (and m_close) once the connection failed
+		bool send(const void* _data, size_t _len);
+		bool fresh(std::string_view _etag, std::string_view _modified) const; // the client's copy is still good
+
+		session* m_session;
+		const req* m_req;
+		char* m_head; // the session's, reused by each response, or the arena's when the headers outgrow it
+		chunker* m_chunks; // streaming
+		bool m_sent;
+		bool m_chunked; // client speaks HTTP/1.1
+		bool m_nobody; // HEAD, headers only
+		bool m_close;
+	};
+
+	class stream // a multipart body on its way to an upload handler
+	{
+	public:
+
+		stream(const char* _head, size_t _len, const jsl_parser& _parser, jsl_arena* _arena);
+		~stream();
+
+		size_t feed(const char* _data, size_t _len); // returns the bytes that were body
+
+		inline bool complete() const { return m_left == 0; }
+
+		std::string m_head; // own copy, m_req slices it
+		req m_req;
+		jsl_multipart m_mpart;
+		jsl_multipart::handler* m_handler;
+		size_t m_left; // body bytes still to come
+		bool m_failed; // remaining body bytes are dropped
+	};
+
+	static constexpr int MAX_RANGES = 8; // in a Range header, more and it's ignored
+
+	typedef struct
+	{
+		size_t m_first;
+		size_t m_last; // inclusive
+	} range_t;
+
+	typedef struct // a file body on its way out, read as the connection takes it
+	{
+		FILE* m_file; // nullptr : none
+		range_t m_ranges[MAX_RANGES];
+		int m_count;
+		int m_next; // range to start
+		size_t m_off; // next byte to send
+		size_t m_end; // past the range being sent
+		size_t m_size;
+		char m_bound[32]; // multipart/byteranges, "" : a single range
+		std::string m_type;
+	} file_t;
+
+	typedef struct // output the connection couldn't take yet
+	{
+		std::string m_copy;
+		const char* m_data; // not copied (flash), nullptr : m_copy
+		size_t m_len;
+		size_t m_off; // sent so far
+	} out_t;
+
+	// Responses never wait for a slow client : what the connection can't take
+	// right away is queued on the session, and a file body is only read as it
+	// goes out. The run loop resumes both on EVENT_WRITE, one connection after
+	// the other. Only a stream outgrowing OUT_QUEUE writes through, blocking.
+
+	static constexpr size_t OUT_QUEUE = 4096; // copied bytes a stream may queue
+
+	class session // per connection state, owned by the run loop
+	{
+	public:
 
-		netconn* m_conn;
+		session(conn_t& _con) : m_conn(&_con), m_arena(s_config.arena_block, s_config.arena_psram), m_stream(nullptr), m_queued(0), m_length(0), m_served(0), m_seen(jsl_clock::ms()), m_busy(false), m_keep(false), m_eof(false), m_probed(false) { m_file.m_file = nullptr; }
+		~session();
+
+		bool receive(); // drain what the connection has into m_data, or m_stream, true if it stopped at max_request
+		err_t send(const jsl_transport::vec_t* _vec, int _count, bool _copy = true); // what doesn't go out right away is queued
+		err_t flush(); // the queue, ERR_WOULDBLOCK while some is left
+		err_t drain(); // the queue, blocking
+		err_t pump(); // the queue then the file, ERR_WOULDBLOCK until it's all out (or the turn is over)
+
+		inline bool sending() const { return m_out.size() || m_file.m_file != nullptr; }
+
+		conn_t* m_conn;
+		std::string m_data;
+		jsl_arena m_arena; // what a request and its response allocate, reset between requests
+		jsl_parser m_parser; // resumes over m_data as it grows
+		stream* m_stream; // upload in progress
+		std::deque<out_t> m_out;
+		size_t m_queued; // copied bytes in m_out
+		file_t m_file;
+		char m_head[res::HEAD];
+		size_t m_length; // of the request being served
+		u16_t m_served; // requests answered so far
+		u32_t m_seen; // last activity (ms)
+		bool m_busy; // handed to a worker
+		bool m_keep; // persist once the response is out
+		bool m_eof; // peer is done sending
+		bool m_probed; // upload routes were looked up for this request
 	};
 
+	static void process(session* _session);
+	static bool upload(session* _session); // true if the body is streamed
+	static void serve(session* _session);
+	static void serve(session* _session, req& _request);
+	static bool output(session* _session); // false until the response is out (EVENT_WRITE resumes it), or once closed
+	static void resume(session* _session); // EVENT_WRITE, the connection has room
+	static bool finish(session* _session); // false once closed
+	static void close(session* _session);
+	static void reject(session* _session, status_t _status); // error response, then close
+	static void expire();
+
+	static void work(void* _ctx);
+
 	static void dispatch(req& _request, res& _response);
+	static target_t route(method_t _method, req& _request); // s_routes then m_router
+	static const jsl_asset_t* asset(const req_t& _req); // at that exact path, routes come first
+	static bool statics(const req_t& _req, res_t& _res); // addStatic mounts, true if a file was sent
+	// Range header against a _size bytes file : the satisfiable ranges count,
+	// 0 if none is (416), -1 to ignore the header (malformed, too many)
+	static int parse_ranges(std::string_view _spec, size_t _size, range_t* _ranges, int _max);
+
+	typedef struct
+	{
+		std::vector<std::string> m_prefix; // segments
+		std::string m_root;
+	} mount_t;
 
 	static jsl_router m_router;
+	static jsl_routes s_routes;
+	static std::map<target_t,upload_t> s_uploads;
+	static std::map<std::string_view,const jsl_asset_t*> s_assets; // by path
+	static std::vector<mount_t> s_statics; // longest prefix first
 	static EventGroupHandle_t s_event_group;
+	static jsl_transport* s_transport;
+	static config_t s_config;
+	static std::vector<session*> s_sessions;
+
+	static jsl_queue<session*>* s_jobs; // run task => workers
+	static jsl_queue<session*>* s_done; // workers => run task
+	static jsl_sem* s_work;
 };
 
 #endif // #ifndef JSL_http_H
@@ -0,0 +1,306 @@
+/*
+	jsl-multipart.cpp
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+#include <algorithm>
+#include <string.h>
+#include <strings.h>
+
+#define LOG_LOCAL_LEVEL ESP_LOG_NONE
+// #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+constexpr char MPART_LOGTAG[] = "MPART :";
+#include "jsl-port.h"
+
+#include "jsl-multipart.h"
+
+constexpr size_t MAX_BOUNDARY = 70; // RFC 2046
+constexpr size_t MAX_HEAD = 1024; // part headers buffered when straddling chunks
+
+static std::string_view trim(std::string_view _str)
+{
+	while(_str.size() && (_str.front() == ' ' || _str.front() == '\t')) _str.remove_prefix(1);
+	while(_str.size() && (_str.back() == ' ' || _str.back() == '\t')) _str.remove_suffix(1);
+	return _str;
+}
+
+static std::string_view unquote(std::string_view _str)
+{
+	if(_str.size() >= 2 && _str.front() == '"' && _str.back() == '"')
+	{
+		_str = _str.substr(1, _str.size() - 2);
+	}
+	return _str;
+}
+
+static bool iequals(std::string_view _a, const char* _b)
+{
+	size_t len = strlen(_b);
+	return _a.size() == len && strncasecmp(_a.data(), _b, len) == 0;
+}
+
+static std::string_view token(std::string_view& _str, char _c) // pops up to the next unquoted _c
+{
+	bool quoted = false;
+	size_t i = 0;
+	for(; i < _str.size(); ++i)
+	{
+		if(_str[i] == '"') quoted = !quoted;
+		else if(_str[i] == _c && !quoted) break;
+	}
+	std::string_view ret = _str.substr(0, i);
+	_str.remove_prefix(i < _str.size() ? i + 1 : i);
+	return trim(ret);
+}
+
+bool jsl_multipart::boundary(std::string_view _ctype)
+{
+	while(_ctype.size())
+	{
+		std::string_view param = token(_ctype, ';');
+		size_t eq = param.find('=');
+		if(eq == std::string_view::npos || !iequals(trim(param.substr(0, eq)), "boundary")) continue;
+
+		std::string_view bound = unquote(trim(param.substr(eq + 1)));
+		if(bound.empty() || bound.size() > MAX_BOUNDARY) return false;
+
+		m_delim = "\r\n--";
+		m_delim += bound;
+		return true;
+	}
+	return false;
+}
+
+jsl_multipart::result_t jsl_multipart::feed(const char* _data, size_t _len)
+{
+	if(m_delim.empty()) return MPART_ERROR; // no boundary()
+
+	const char* end = _data + _len;
+
+	while(_data < end)
+	{
+		switch(m_state)
+		{
+			case STATE_PREAMBLE:
+			case STATE_DATA:
+			{
+				const char* next = scan(_data, end);
+				if(next == nullptr) return m_state == STATE_ERROR ? MPART_ERROR : MPART_MORE;
+				if(m_state == STATE_DATA && !m_handler->end()) goto error;
+				_data = next;
+				m_state = STATE_DELIM;
+				break;
+			}
+
+			case STATE_DELIM:
+				if(*_data == '-')
+				{
+					m_state = STATE_DELIM_END;
+				}
+				else if(*_data == '\r')
+				{
+					m_head.clear();
+					m_state = STATE_HEAD;
+					continue; // that CRLF opens the part headers
+				}
+				else if(*_data != ' ' && *_data != '\t') // transport padding
+				{
+					goto error;
+				}
+				++_data;
+				break;
+
+			case STATE_DELIM_END:
+				if(*_data != '-') goto error;
+				m_state = STATE_DONE;
+				return MPART_DONE;
+
+			case STATE_HEAD:
+			{
+				const char* next = head(_data, end);
+				if(next == nullptr) return m_state == STATE_ERROR ? MPART_ERROR : MPART_MORE;
+				_data = next;
+				m_state = STATE_DATA;
+				break;
+			}
+
+			case STATE_DONE:
+				return MPART_DONE; // epilogue
+
+			default:
+				return MPART_ERROR;
+		}
+	}
+
+	return m_state == STATE_DONE ? MPART_DONE : MPART_MORE;
+
+error:
+
+	ESP_LOGW(MPART_LOGTAG,"Malformed or aborted multipart body");
+	m_state = STATE_ERROR;
+	return MPART_ERROR;
+}
+
+const char* jsl_multipart::scan(const char* _data, const char* _end)
+{
+	const char* delim = m_delim.data();
+	size_t dlen = m_delim.size();
+
+	if(m_match > 0) // the previous chunk ended on what may be a boundary
+	{
+		size_t match = m_match;
+		while(_data < _end && match < dlen && *_data == delim[match])
+		{
+			++_data;
+			++match;
+		}
+
+		if(match == dlen)
+		{
+			m_match = 0;
+			return _data;
+		}
+
+		if(_data == _end)
+		{
+			m_match = match;
+			return nullptr;
+		}
+
+		// it wasn't, the held back bytes are data (there's no CR in a boundary so
+		// none of them can start another match)
+		m_match = 0;
+		if(!emit(delim, match)) return nullptr;
+	}
+
+	const char* run = _data; // emitted in one go, so data stays contiguous within a chunk
+
+	while(_data < _end)
+	{
+		const char* cr = (const char*)memchr(_data, '\r', _end - _data);
+		if(cr == nullptr) break;
+
+		size_t len = std::min(dlen, (size_t)(_end - cr));
+		if(memcmp(cr, delim, len) == 0)
+		{
+			if(!emit(run, cr - run)) return nullptr;
+			if(len == dlen) return cr + dlen;
+
+			m_match = len;
+			return nullptr;
+		}
+
+		_data = cr + 1;
+	}
+
+	emit(run, _end - run);
+	return nullptr;
+}
+
+const char* jsl_multipart::head(const char* _data, const char* _end)
+{
+	static const char blank[] = "\r\n\r\n";
+
+	if(m_head.empty()) // the usual case, all the headers came in this chunk
+	{
+		const char* last = std::search(_data, _end, blank, blank + 4);
+		if(last != _end)
+		{
+			if(!open(std::string_view(_data, last + 2 - _data))) return nullptr;
+			return last + 4;
+		}
+	}
+
+	size_t from = m_head.size() > 3 ? m_head.size() - 3 : 0;
+	m_head.append(_data, _end - _data);
+
+	size_t last = m_head.find(blank, from);
+	if(last == std::string::npos)
+	{
+		if(m_head.size() > MAX_HEAD) m_state = STATE_ERROR;
+		return nullptr;
+	}
+
+	const char* next = _end - (m_head.size() - (last + 4)); // data starts in this chunk
+	m_head.resize(last + 2);
+	if(!open(m_head)) return nullptr;
+	return next;
+}
+
+bool jsl_multipart::open(std::string_view _head)
+{
+	part_t part;
+
+	while(_head.size())
+	{
+		size_t eol = _head.find("\r\n");
+		std::string_view line = _head.substr(0, eol);
+		_head.remove_prefix(eol == std::string_view::npos ? _head.size() : eol + 2);
+
+		size_t colon = line.find(':');
+		if(colon == std::string_view::npos) continue;
+
+		std::string_view name = trim(line.substr(0, colon));
+		std::string_view value = trim(line.substr(colon + 1));
+
+		if(iequals(name, "Content-Disposition")) // form-data; name="field"; filename="file.bin"
+		{
+			token(value, ';');
+			while(value.size())
+			{
+				std::string_view param = token(value, ';');
+				size_t eq = param.find('=');
+				if(eq == std::string_view::npos) continue;
+
+				std::string_view key = trim(param.substr(0, eq));
+				std::string_view val = unquote(trim(param.substr(eq + 1)));
+				if(iequals(key, "name")) part.m_name = val;
+				else if(iequals(key, "filename")) part.m_filename = val;
+			}
+		}
+		else if(iequals(name, "Content-Type"))
+		{
+			part.m_type = value;
+		}
+	}
+
+	ESP_LOGD(MPART_LOGTAG,"Part [%.*s]",(int)part.m_name.size(),part.m_name.data());
+
+	if(!m_handler->part(part))
+	{
+		m_state = STATE_ERROR;
+		return false;
+	}
+	return true;
+}
+
+bool jsl_multipart::emit(const char* _data, size_t _len)
+{
+	if(m_state == STATE_PREAMBLE || _len == 0) return true;
+
+	if(!m_handler->data(_data, _len))
+	{
+		m_state = STATE_ERROR;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,104 @@
+/*
+	jsl-multipart.h
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+#ifndef JSL_MULTIPART_H
+#define JSL_MULTIPART_H
+
+#include <string>
+#include <string_view>
+#include <stddef.h>
+
+#include "jsl-port.h"
+
+// Streaming multipart/form-data parser.
+// The body may be fed in chunks cut anywhere, parts headers and data are
+// handed to a handler as soon as they are known : data is never buffered,
+// a boundary straddling two chunks is held back as a count of matched bytes.
+
+class jsl_multipart
+{
+public:
+
+	typedef enum
+	{
+		MPART_MORE, // feed again with the next bytes
+		MPART_DONE, // closing boundary seen, what follows is ignored
+		MPART_ERROR // malformed, or aborted by the handler
+	} result_t;
+
+	typedef struct
+	{
+		std::string_view m_name; // Content-Disposition directives
+		std::string_view m_filename;
+		std::string_view m_type; // Content-Type, empty if not given
+	} part_t; // valid for the duration of the part() call only
+
+	class handler
+	{
+	public:
+
+		virtual ~handler() {}
+
+		virtual bool part(const part_t& _part) = 0; // a part begins, false aborts
+		virtual bool data(const char* _data, size_t _len) = 0; // next bytes of the current part, false aborts
+		virtual bool end() { return true; } // the current part is complete, false aborts
+		virtual void close(bool _complete) {} // the body is over, _complete false if malformed, aborted or cut short
+	};
+
+	jsl_multipart(handler* _handler = nullptr) : m_handler(_handler), m_state(STATE_PREAMBLE), m_match(2) {}
+
+	inline void setHandler(handler* _handler) { m_handler = _handler; }
+
+	bool boundary(std::string_view _ctype); // from the Content-Type header, false if there is none
+	result_t feed(const char* _data, size_t _len);
+
+	inline bool done() const { return m_state == STATE_DONE; }
+
+protected:
+
+	typedef enum
+	{
+		STATE_PREAMBLE, // skipped up to the first boundary
+		STATE_DELIM, // right after a boundary : "--" closes, CRLF opens a part
+		STATE_DELIM_END,
+		STATE_HEAD,
+		STATE_DATA,
+		STATE_DONE,
+		STATE_ERROR
+	} state_t;
+
+	const char* scan(const char* _data, const char* _end); // looks for m_delim, returns past it or nullptr
+	const char* head(const char* _data, const char* _end); // returns past the blank line or nullptr
+	bool open(std::string_view _head); // parse the part headers
+	bool emit(const char* _data, size_t _len);
+
+	handler* m_handler;
+	u8_t m_state;
+	size_t m_match; // m_delim bytes matched at the end of the last chunk, held back
+	std::string m_delim; // CRLF "--" boundary
+	std::string m_head; // part headers straddling chunks
+};
+
+#endif // #ifndef JSL_MULTIPART_H
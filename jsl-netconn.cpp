@@ -0,0 +1,335 @@
+/*
+	jsl-netconn.cpp
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+#ifdef ESP_PLATFORM
+
+#define LOG_LOCAL_LEVEL ESP_LOG_NONE
+// #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+constexpr char NETCONN_LOGTAG[] = "NETCONN :";
+#include "jsl-port.h"
+
+#include "jsl-netconn.h"
+
+QueueHandle_t jsl_netconn::s_ready = nullptr;
+netconn* jsl_netconn::s_listen = nullptr;
+std::atomic<bool> jsl_netconn::s_accept(false);
+std::atomic<bool> jsl_netconn::s_woken(false);
+std::atomic<bool> jsl_netconn::s_overflow(false);
+
+constexpr int SEND_TIMEOUT = 10000; // ms a blocking write may wait for room
+
+// The nconn of a netconn, in the slot lwIP keeps for the sockets layer
+// (unused by raw netconns). Unset, it holds -1.
+
+static inline void set_arg(netconn* _conn, void* _arg)
+{
+#ifdef netconn_set_callback_arg // lwIP 2.1
+	netconn_set_callback_arg(_conn, _arg);
+#else
+	_conn->socket = (int)(intptr_t)_arg;
+#endif
+}
+
+static inline void* get_arg(netconn* _conn)
+{
+#ifdef netconn_get_callback_arg
+	void* arg = netconn_get_callback_arg(_conn);
+#else
+	void* arg = (void*)(intptr_t)_conn->socket;
+#endif
+	return arg == (void*)(intptr_t)-1 ? nullptr : arg;
+}
+
+void jsl_netconn::callback(netconn* _conn, netconn_evt _evt, u16_t _len)
+{
+	if(_evt != NETCONN_EVT_RCVPLUS && _evt != NETCONN_EVT_SENDPLUS && _evt != NETCONN_EVT_ERROR) return;
+	if(s_ready == nullptr) return;
+
+	if(_conn == s_listen)
+	{
+		post(_conn, s_accept);
+		return;
+	}
+
+	nconn* c = (nconn*)get_arg(_conn);
+	if(c != nullptr && (_evt != NETCONN_EVT_SENDPLUS || c->m_write)) // else not accepted yet, the accept has it read anyway
+	{
+		post(_conn, c->m_pending);
+	}
+}
+
+void jsl_netconn::post(netconn* _conn, std::atomic<bool>& _pending)
+{
+	if(_pending.exchange(true)) return; // already queued
+
+	if(xQueueSend(s_ready, &_conn, 0) != pdTRUE)
+	{
+		s_overflow = true; // the flag stays up, wait() scans for it
+	}
+}
+
+err_t jsl_netconn::listen(u16_t _port, u16_t _max_conns)
+{
+	if(s_ready == nullptr)
+	{
+		s_ready = xQueueCreate(_max_conns + 2, sizeof(netconn*)); // every conn, the listener and a wake, once each
+		if(s_ready == nullptr) return ERR_MEM;
+	}
+
+	m_listen = netconn_new_with_callback(NETCONN_TCP, callback); // accepted conns inherit the callback
+	if(m_listen == nullptr) return ERR_MEM;
+	s_listen = m_listen;
+
+	err_t ret = netconn_bind(m_listen, IP_ADDR_ANY, _port);
+	if(ret == ERR_OK)
+	{
+		ret = netconn_listen(m_listen);
+	}
+
+	if(ret != ERR_OK)
+	{
+		ESP_LOGE(NETCONN_LOGTAG,"Listen failed on port %d (%d)",_port,ret);
+		shutdown();
+		return ret;
+	}
+
+	netconn_set_nonblocking(m_listen,1);
+
+	return ERR_OK;
+}
+
+int jsl_netconn::wait(event_t* _events, int _max, u32_t _timeout)
+{
+	int count = 0;
+	netconn* conn = nullptr;
+	TickType_t ticks = s_overflow ? 0 : pdMS_TO_TICKS(_timeout);
+	while(count < _max && xQueueReceive(s_ready, &conn, ticks) == pdTRUE)
+	{
+		count += ready(conn, _events + count, _max - count);
+		ticks = 0;
+	}
+
+	if(count < _max && s_overflow.exchange(false)) // flags raised without a queue slot
+	{
+		if(s_accept.exchange(false))
+		{
+			count += accept(_events + count, _max - count);
+		}
+		for(auto& c : m_conns)
+		{
+			if(count == _max)
+			{
+				s_overflow = true; // the rest next time
+				break;
+			}
+			if(c.second->m_pending.exchange(false))
+			{
+				_events[count].m_conn = c.second;
+				_events[count].m_flags = c.second->events();
+				++count;
+			}
+		}
+	}
+
+	return count; // 0 : timeout or wake
+}
+
+int jsl_netconn::ready(netconn* _conn, event_t* _events, int _max)
+{
+	if(_conn == nullptr)
+	{
+		s_woken = false;
+		return 0;
+	}
+
+	if(_conn == m_listen)
+	{
+		s_accept = false;
+		return accept(_events, _max);
+	}
+
+	auto c = m_conns.find(_conn);
+	if(c == m_conns.end()) return 0; // closed since
+
+	c->second->m_pending = false; // before the recv, what comes in after queues it again
+	_events[0].m_conn = c->second;
+	_events[0].m_flags = c->second->events();
+	return 1;
+}
+
+void jsl_netconn::watch(conn* _conn, u8_t _events)
+{
+	nconn* c = static_cast<nconn*>(_conn);
+	bool write = _events & EVENT_WRITE;
+
+	// the acks may have made room before the flag went up, nothing would
+	// report it : one event to try again, the next come with the acks
+	if(write && !c->m_write.exchange(true))
+	{
+		post(c->m_conn, c->m_pending);
+	}
+	c->m_write = write;
+}
+
+void jsl_netconn::wake()
+{
+	post(nullptr, s_woken);
+}
+
+int jsl_netconn::accept(event_t* _events, int _max)
+{
+	int count = 0;
+	while(count < _max)
+	{
+		netconn* newconn = nullptr;
+		if(netconn_accept(m_listen, &newconn) != ERR_OK || newconn == nullptr)
+		{
+			return count;
+		}
+
+		nconn* c = new nconn(newconn);
+		m_conns[newconn] = c;
+		set_arg(newconn, c); // from now on the callback flags it
+#if LWIP_SO_SNDTIMEO
+		netconn_set_sendtimeout(newconn, SEND_TIMEOUT); // blocking writes, a peer that stopped reading can't hold the task
+#endif
+
+		// data may have come in before the accept, have it read right away
+		_events[count].m_conn = c;
+		_events[count].m_flags = EVENT_ACCEPT | EVENT_READ;
+		++count;
+	}
+
+	post(m_listen, s_accept); // out of room, there may be more pending
+	return count;
+}
+
+void jsl_netconn::close(conn* _conn)
+{
+	nconn* c = static_cast<nconn*>(_conn);
+	m_conns.erase(c->m_conn);
+	set_arg(c->m_conn, nullptr); // the close goes through the tcpip thread, no callback holds c past it
+	if(c->m_pbuf != nullptr)
+	{
+		pbuf_free(c->m_pbuf);
+	}
+	netconn_close(c->m_conn);
+	netconn_delete(c->m_conn);
+	delete c;
+}
+
+void jsl_netconn::shutdown()
+{
+	while(m_conns.size())
+	{
+		close(m_conns.begin()->second);
+	}
+
+	if(m_listen == nullptr) return;
+
+	netconn_close(m_listen);
+	netconn_delete(m_listen);
+	m_listen = nullptr;
+	s_listen = nullptr;
+}
+
+err_t jsl_netconn::nconn::recv(char* _buf, size_t _len, size_t& _read)
+{
+	_read = 0;
+
+	if(m_pbuf == nullptr)
+	{
+		err_t ret = netconn_recv_tcp_pbuf_flags(m_conn, &m_pbuf, NETCONN_DONTBLOCK);
+		if(ret != ERR_OK)
+		{
+			m_pbuf = nullptr;
+			return ret;
+		}
+		m_offset = 0;
+	}
+
+	_read = pbuf_copy_partial(m_pbuf, _buf, _len > 0xffff ? 0xffff : _len, m_offset);
+	m_offset += _read;
+
+	if(m_offset >= m_pbuf->tot_len)
+	{
+		pbuf_free(m_pbuf);
+		m_pbuf = nullptr;
+	}
+
+	return ERR_OK;
+}
+
+err_t jsl_netconn::nconn::send(const vec_t* _vec, int _count, size_t& _sent, bool _copy)
+{
+	_sent = 0;
+	u8_t flags = (_copy ? NETCONN_COPY : NETCONN_NOCOPY) | NETCONN_DONTBLOCK;
+
+#if LWIP_VERSION >= 0x02010000 // one call, the pieces share segments
+	constexpr int MAX_VEC = 8;
+	netvector vec[MAX_VEC];
+	while(_count > 0)
+	{
+		int count = _count < MAX_VEC ? _count : MAX_VEC;
+		size_t len = 0;
+		for(int i = 0; i < count; ++i)
+		{
+			vec[i].ptr = _vec[i].m_data;
+			vec[i].len = _vec[i].m_len;
+			len += _vec[i].m_len;
+		}
+		size_t sent = 0;
+		err_t ret = netconn_write_vectors_partly(m_conn, vec, count, flags | (count < _count ? NETCONN_MORE : 0), &sent);
+		if(ret == ERR_WOULDBLOCK) return ERR_OK; // full
+		if(ret != ERR_OK) return ret;
+		_sent += sent;
+		if(sent < len) break; // full
+		_vec += count;
+		_count -= count;
+	}
+	return ERR_OK;
+#else // PSH on the last piece only
+	for(int i = 0; i < _count; ++i)
+	{
+		size_t sent = 0;
+		err_t ret = netconn_write_partly(m_conn, _vec[i].m_data, _vec[i].m_len, flags | (i + 1 < _count ? NETCONN_MORE : 0), &sent);
+		if(ret == ERR_WOULDBLOCK) return ERR_OK; // full
+		if(ret != ERR_OK) return ret;
+		_sent += sent;
+		if(sent < _vec[i].m_len) break; // full
+	}
+	return ERR_OK;
+#endif
+}
+
+err_t jsl_netconn::nconn::write(const void* _data, size_t _len, bool _copy)
+{
+	// with a send timeout lwIP wants the written count, short when it expired
+	size_t sent = 0;
+	err_t ret = netconn_write_partly(m_conn, _data, _len, _copy ? NETCONN_COPY : NETCONN_NOCOPY, &sent);
+	if(ret == ERR_WOULDBLOCK || (ret == ERR_OK && sent < _len)) return ERR_TIMEOUT;
+	return ret;
+}
+
+#endif // #ifdef ESP_PLATFORM
@@ -0,0 +1,102 @@
+/*
+	jsl-netconn.h
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+#ifndef JSL_NETCONN_H
+#define JSL_NETCONN_H
+
+#include <atomic>
+#include <map>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include <lwip/api.h>
+#include <lwip/err.h>
+#include <lwip/init.h>
+#include <lwip/pbuf.h>
+
+#include "jsl-transport.h"
+
+class jsl_netconn : // lwIP netconn backend (esp32)
+	public jsl_transport
+{
+public:
+
+	jsl_netconn() : m_listen(nullptr) {}
+
+	virtual err_t listen(u16_t _port, u16_t _max_conns);
+	virtual int wait(event_t* _events, int _max, u32_t _timeout);
+	virtual void wake();
+	virtual void watch(conn* _conn, u8_t _events); // reads are one-shot events, never suspended
+	virtual void close(conn* _conn);
+	virtual void shutdown();
+
+protected:
+
+	class nconn :
+		public conn
+	{
+	public:
+
+		nconn(netconn* _con) : m_conn(_con), m_pbuf(nullptr), m_offset(0), m_pending(false), m_write(false) {}
+
+		virtual err_t recv(char* _buf, size_t _len, size_t& _read);
+		virtual err_t send(const vec_t* _vec, int _count, size_t& _sent, bool _copy = true);
+		virtual err_t write(const void* _data, size_t _len, bool _copy = true);
+
+		inline u8_t events() const { return EVENT_READ | (m_write ? EVENT_WRITE : 0); }
+
+		netconn* m_conn;
+		pbuf* m_pbuf; // partially consumed segment
+		u16_t m_offset;
+		std::atomic<bool> m_pending; // queued in s_ready, set by the callback, cleared by wait()
+		std::atomic<bool> m_write; // EVENT_WRITE watched, room freed by acks queues it
+	};
+
+	// Readiness is a flag per connection, a netconn is only queued when its
+	// flag goes up, so the queue never holds it twice and never fills up :
+	// one slot per connection, the listener and a wake. Should a post fail
+	// anyway, wait() finds the raised flags by scanning the connections.
+	// Room freed by the acks (SENDPLUS) only raises it while EVENT_WRITE is
+	// watched, the same flag stands for both.
+
+	// Runs in the tcpip thread : only flags the netconn for the server task
+	static void callback(netconn* _conn, netconn_evt _evt, u16_t _len);
+	static void post(netconn* _conn, std::atomic<bool>& _pending);
+
+	int ready(netconn* _conn, event_t* _events, int _max);
+	int accept(event_t* _events, int _max);
+
+	netconn* m_listen;
+	std::map<netconn*,nconn*> m_conns;
+
+	static QueueHandle_t s_ready;
+	static netconn* s_listen;
+	static std::atomic<bool> s_accept; // s_listen queued
+	static std::atomic<bool> s_woken; // nullptr queued
+	static std::atomic<bool> s_overflow; // a post didn't fit
+};
+
+#endif // #ifndef JSL_NETCONN_H
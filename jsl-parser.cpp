@@ -0,0 +1,230 @@
+/*
+	jsl-parser.cpp
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+#include <string.h>
+#include <strings.h>
+
+#define LOG_LOCAL_LEVEL ESP_LOG_NONE
+// #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
+constexpr char PARSER_LOGTAG[] = "PARSER :";
+#include "jsl-port.h"
+
+#include "jsl-parser.h"
+
+void jsl_parser::reset()
+{
+	m_state = STATE_METHOD;
+	m_pos = 0;
+	m_mark = 0;
+	m_method = m_uri = m_version = m_body = m_name = span_t{0,0};
+	m_headers.clear();
+	m_clength = 0;
+	m_sized = false;
+}
+
+jsl_parser::result_t jsl_parser::feed(const char* _data, size_t _len)
+{
+	while(m_pos < _len)
+	{
+		char c = _data[m_pos];
+
+		switch(m_state)
+		{
+			case STATE_METHOD:
+				if(c == ' ')
+				{
+					if(m_pos == m_mark) goto error;
+					m_method = span_t{(u32_t)m_mark, (u32_t)(m_pos - m_mark)};
+					m_mark = m_pos + 1;
+					m_state = STATE_URI;
+				}
+				else if((c == '\r' || c == '\n') && m_pos == m_mark)
+				{
+					m_mark = m_pos + 1; // stray empty lines before a request are tolerated
+				}
+				else if(c < '!' || c > '~')
+				{
+					goto error;
+				}
+				break;
+
+			case STATE_URI:
+			{
+				const char* sp = (const char*)memchr(_data + m_pos, ' ', _len - m_pos);
+				size_t end = sp ? sp - _data : _len;
+				if(memchr(_data + m_pos, '\n', end - m_pos) != nullptr) goto error; // HTTP/0.9 or garbage
+				m_pos = end;
+				if(sp == nullptr) return PARSE_MORE;
+
+				if(m_pos == m_mark) goto error;
+				m_uri = span_t{(u32_t)m_mark, (u32_t)(m_pos - m_mark)};
+				m_mark = m_pos + 1;
+				m_state = STATE_VERSION;
+				break;
+			}
+
+			case STATE_VERSION:
+				if(c == '\r' || c == '\n')
+				{
+					m_version = span_t{(u32_t)m_mark, (u32_t)(m_pos - m_mark)};
+					if(m_version.m_len != 8 || strncmp(_data + m_mark, "HTTP/1.", 7) != 0) goto error;
+					m_state = c == '\r' ? STATE_REQUEST_LF : STATE_FIELD_START;
+				}
+				break;
+
+			case STATE_REQUEST_LF:
+				if(c != '\n') goto error;
+				m_state = STATE_FIELD_START;
+				break;
+
+			case STATE_FIELD_START:
+				if(c == '\r')
+				{
+					m_state = STATE_HEAD_LF;
+				}
+				else if(c == '\n')
+				{
+					++m_pos;
+					head();
+					continue;
+				}
+				else if(c == ' ' || c == '\t' || c == ':')
+				{
+					goto error; // obsolete line folding or empty name
+				}
+				else
+				{
+					m_mark = m_pos;
+					m_state = STATE_FIELD_NAME;
+				}
+				break;
+
+			case STATE_FIELD_NAME:
+				if(c == ':')
+				{
+					m_name = span_t{(u32_t)m_mark, (u32_t)(m_pos - m_mark)};
+					m_state = STATE_FIELD_WS;
+				}
+				else if(c == '\r' || c == '\n' || c == ' ')
+				{
+					goto error;
+				}
+				break;
+
+			case STATE_FIELD_WS:
+				if(c == ' ' || c == '\t') break;
+				m_mark = m_pos;
+				m_state = STATE_FIELD_VALUE;
+				continue; // same byte, as a value
+
+			case STATE_FIELD_VALUE:
+			{
+				const char* eol = (const char*)memchr(_data + m_pos, '\n', _len - m_pos);
+				if(eol == nullptr)
+				{
+					m_pos = _len;
+					return PARSE_MORE;
+				}
+				m_pos = eol - _data;
+				if(field(_data) == PARSE_ERROR) goto error;
+				m_state = STATE_FIELD_START;
+				break;
+			}
+
+			case STATE_HEAD_LF:
+				if(c != '\n') goto error;
+				++m_pos;
+				head();
+				continue;
+
+			case STATE_BODY:
+				if(_len - m_pos < m_clength - (m_pos - m_body.m_off))
+				{
+					m_pos = _len;
+					return PARSE_MORE;
+				}
+				m_pos = m_body.m_off + m_clength;
+				m_state = STATE_DONE;
+				continue;
+
+			case STATE_DONE:
+				return PARSE_DONE;
+
+			default:
+				return PARSE_ERROR;
+		}
+
+		++m_pos;
+	}
+
+	return m_state == STATE_DONE ? PARSE_DONE : PARSE_MORE;
+
+error:
+
+	ESP_LOGW(PARSER_LOGTAG,"Malformed request at byte %d",(int)m_pos);
+	m_state = STATE_ERROR;
+	return PARSE_ERROR;
+}
+
+jsl_parser::result_t jsl_parser::field(const char* _data)
+{
+	// value runs from m_mark up to the '\n' at m_pos, drop the '\r' and trailing blanks
+	size_t end = m_pos;
+	while(end > m_mark && (_data[end - 1] == '\r' || _data[end - 1] == ' ' || _data[end - 1] == '\t')) --end;
+
+	field_t f = { m_name, span_t{(u32_t)m_mark, (u32_t)(end - m_mark)} };
+	m_headers.push_back(f);
+
+	const char* name = _data + f.m_name.m_off;
+	if(f.m_name.m_len == 14 && strncasecmp(name, "Content-Length", 14) == 0)
+	{
+		// digits only (no sign, no blank), within the 32 bits of a span, and
+		// any repeat must agree : framing ambiguities are how requests get smuggled
+		if(f.m_value.m_len == 0) return PARSE_ERROR;
+
+		uint64_t len = 0;
+		for(const char* c = _data + f.m_value.m_off; c < _data + end; ++c)
+		{
+			if(*c < '0' || *c > '9') return PARSE_ERROR;
+			len = len * 10 + (*c - '0');
+			if(len > 0xffffffffull) return PARSE_ERROR;
+		}
+
+		if(m_sized && len != m_clength) return PARSE_ERROR;
+		m_clength = len;
+		m_sized = true;
+	}
+	else if(f.m_name.m_len == 17 && strncasecmp(name, "Transfer-Encoding", 17) == 0)
+	{
+		return PARSE_ERROR; // chunked request bodies are not supported
+	}
+
+	return PARSE_MORE;
+}
+
+void jsl_parser::head()
+{
+	m_body = span_t{(u32_t)m_pos, (u32_t)m_clength};
+	m_state = m_clength > 0 ? STATE_BODY : STATE_DONE;
+}
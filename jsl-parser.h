@@ -0,0 +1,112 @@
+/*
+	jsl-parser.h
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+#ifndef JSL_PARSER_H
+#define JSL_PARSER_H
+
+#include <vector>
+#include <stddef.h>
+
+#include "jsl-port.h"
+
+// Resumable HTTP/1.x request parser.
+// feed() is handed the whole connection buffer each time more bytes come in,
+// it resumes where it stopped and only records spans (offset, length) into
+// that buffer, nothing is copied.
+
+class jsl_parser
+{
+public:
+
+	typedef enum
+	{
+		PARSE_MORE, // incomplete, feed again once more bytes are in
+		PARSE_DONE, // length() bytes hold a complete request
+		PARSE_ERROR // malformed, the connection can't be trusted any more
+	} result_t;
+
+	typedef struct
+	{
+		u32_t m_off;
+		u32_t m_len;
+	} span_t;
+
+	typedef struct
+	{
+		span_t m_name;
+		span_t m_value;
+	} field_t;
+
+	jsl_parser() { reset(); }
+
+	void reset();
+	result_t feed(const char* _data, size_t _len);
+
+	inline size_t length() const { return m_pos; } // of the parsed request, once done
+	inline bool headed() const { return m_state == STATE_BODY || m_state == STATE_DONE; } // head complete, body() known
+
+	inline const span_t& method() const { return m_method; }
+	inline const span_t& uri() const { return m_uri; }
+	inline const span_t& version() const { return m_version; }
+	inline const span_t& body() const { return m_body; }
+	inline const std::vector<field_t>& headers() const { return m_headers; }
+
+protected:
+
+	typedef enum
+	{
+		STATE_METHOD,
+		STATE_URI,
+		STATE_VERSION,
+		STATE_REQUEST_LF,
+		STATE_FIELD_START,
+		STATE_FIELD_NAME,
+		STATE_FIELD_WS,
+		STATE_FIELD_VALUE,
+		STATE_HEAD_LF,
+		STATE_BODY,
+		STATE_DONE,
+		STATE_ERROR
+	} state_t;
+
+	result_t field(const char* _data); // a header line just completed
+	void head(); // the empty line closing the headers just went by
+
+	u8_t m_state;
+	size_t m_pos; // next byte to look at
+	size_t m_mark; // start of the token being read
+
+	span_t m_method;
+	span_t m_uri;
+	span_t m_version;
+	span_t m_body;
+	span_t m_name;
+	std::vector<field_t> m_headers;
+
+	size_t m_clength;
+	bool m_sized; // a Content-Length went by
+};
+
+#endif // #ifndef JSL_PARSER_H
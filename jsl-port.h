@@ -0,0 +1,247 @@
+/*
+	jsl-port.h
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+#ifndef JSL_PORT_H
+#define JSL_PORT_H
+
+// Platform glue : on the esp32 this pulls the IDF / lwIP headers, anywhere
+// else (dev box load testing) it provides the few stand-ins the server needs.
+
+#ifdef ESP_PLATFORM
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <lwip/err.h>
+
+#else // POSIX
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifndef LWIP_HDR_ARCH_H
+typedef uint8_t   u8_t;
+typedef int8_t    s8_t;
+typedef uint16_t  u16_t;
+typedef int16_t   s16_t;
+typedef uint32_t  u32_t;
+typedef int32_t   s32_t;
+#endif
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+typedef void* EventGroupHandle_t;
+
+// lwIP error codes (same values as lwip/err.h)
+typedef s8_t err_t;
+enum
+{
+	ERR_OK = 0,
+	ERR_MEM = -1,
+	ERR_BUF = -2,
+	ERR_TIMEOUT = -3,
+	ERR_VAL = -6,
+	ERR_WOULDBLOCK = -7,
+	ERR_USE = -8,
+	ERR_CONN = -11,
+	ERR_ABRT = -13,
+	ERR_RST = -14,
+	ERR_CLSD = -15,
+	ERR_ARG = -16
+};
+
+// esp_log.h look-alike, honours the including unit's LOG_LOCAL_LEVEL
+typedef enum
+{
+	ESP_LOG_NONE,
+	ESP_LOG_ERROR,
+	ESP_LOG_WARN,
+	ESP_LOG_INFO,
+	ESP_LOG_DEBUG,
+	ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL ESP_LOG_NONE
+#endif
+
+#define JSL_LOG(level, letter, tag, format, ...) \
+	do { if(LOG_LOCAL_LEVEL >= level) fprintf(stderr, letter " %s " format "\n", tag, ##__VA_ARGS__); } while(0)
+
+#define ESP_LOGE(tag, format, ...) JSL_LOG(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) JSL_LOG(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) JSL_LOG(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) JSL_LOG(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) JSL_LOG(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+
+#define xPortGetCoreID() 0
+
+#endif // #ifdef ESP_PLATFORM
+
+class jsl_clock
+{
+public:
+
+	static u32_t ms() // monotonic, wraps around
+	{
+#ifdef ESP_PLATFORM
+		return xTaskGetTickCount() * portTICK_PERIOD_MS;
+#else
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+	}
+};
+
+class jsl_sem // counting semaphore
+{
+public:
+
+#ifdef ESP_PLATFORM
+
+	jsl_sem() { m_sem = xSemaphoreCreateCounting(0x7fff, 0); }
+	~jsl_sem() { vSemaphoreDelete(m_sem); }
+
+	inline void give() { xSemaphoreGive(m_sem); }
+	inline bool take() { return xSemaphoreTake(m_sem, portMAX_DELAY) == pdTRUE; }
+
+protected:
+
+	SemaphoreHandle_t m_sem;
+
+#else
+
+	jsl_sem() { sem_init(&m_sem, 0, 0); }
+	~jsl_sem() { sem_destroy(&m_sem); }
+
+	inline void give() { sem_post(&m_sem); }
+	inline bool take() { return sem_wait(&m_sem) == 0; }
+
+protected:
+
+	sem_t m_sem;
+
+#endif
+};
+
+class jsl_mutex // lock() / unlock(), fits std::lock_guard
+{
+public:
+
+#ifdef ESP_PLATFORM
+
+	jsl_mutex() { m_mutex = xSemaphoreCreateMutex(); }
+	~jsl_mutex() { vSemaphoreDelete(m_mutex); }
+
+	inline void lock() { xSemaphoreTake(m_mutex, portMAX_DELAY); }
+	inline void unlock() { xSemaphoreGive(m_mutex); }
+
+protected:
+
+	SemaphoreHandle_t m_mutex;
+
+#else
+
+	jsl_mutex() { pthread_mutex_init(&m_mutex, nullptr); }
+	~jsl_mutex() { pthread_mutex_destroy(&m_mutex); }
+
+	inline void lock() { pthread_mutex_lock(&m_mutex); }
+	inline void unlock() { pthread_mutex_unlock(&m_mutex); }
+
+protected:
+
+	pthread_mutex_t m_mutex;
+
+#endif
+
+	jsl_mutex(const jsl_mutex&) = delete;
+	jsl_mutex& operator=(const jsl_mutex&) = delete;
+};
+
+class jsl_task
+{
+public:
+
+	typedef void (*entry_t)(void* _ctx);
+
+	// _core < 0 : let the scheduler pick
+	static bool spawn(entry_t _entry, const char* _name, u32_t _stack, void* _ctx, u8_t _prio, s8_t _core)
+	{
+#ifdef ESP_PLATFORM
+		return xTaskCreatePinnedToCore(
+			_entry, _name, _stack, _ctx, _prio, nullptr,
+			_core < 0 ? tskNO_AFFINITY : _core
+		) == pdPASS;
+#else
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		bool ret = pthread_create(&thread, &attr, trampoline, new start_t{_entry, _ctx}) == 0;
+		pthread_attr_destroy(&attr);
+		return ret;
+#endif
+	}
+
+	static u8_t cores()
+	{
+#ifdef ESP_PLATFORM
+		return portNUM_PROCESSORS;
+#else
+		return 2;
+#endif
+	}
+
+#ifndef ESP_PLATFORM
+protected:
+
+	struct start_t
+	{
+		entry_t m_entry;
+		void* m_ctx;
+	};
+
+	static void* trampoline(void* _start)
+	{
+		start_t start = *(start_t*)_start;
+		delete (start_t*)_start;
+		start.m_entry(start.m_ctx);
+		return nullptr;
+	}
+#endif
+};
+
+#endif // #ifndef JSL_PORT_H
@@ -0,0 +1,132 @@
+/*
+	jsl-queue.h
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+#ifndef JSL_QUEUE_H
+#define JSL_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bounded lock free multi producer / multi consumer ring (D. Vyukov's design).
+// Each cell carries a sequence number telling whether it is ready to be
+// written (seq == pos) or read (seq == pos + 1), so push and pop only ever
+// contend on a single compare-exchange.
+
+template<typename T>
+class jsl_queue
+{
+public:
+
+	jsl_queue(size_t _size) // rounded up to a power of two
+	{
+		size_t size = 2;
+		while(size < _size) size <<= 1;
+
+		m_mask = size - 1;
+		m_cells = new cell[size];
+		for(size_t i = 0; i < size; ++i)
+		{
+			m_cells[i].m_seq.store(i, std::memory_order_relaxed);
+		}
+
+		m_head.store(0, std::memory_order_relaxed);
+		m_tail.store(0, std::memory_order_relaxed);
+	}
+
+	~jsl_queue() { delete[] m_cells; }
+
+	bool push(const T& _val) // false when full
+	{
+		size_t pos = m_tail.load(std::memory_order_relaxed);
+		for(;;)
+		{
+			cell& c = m_cells[pos & m_mask];
+			size_t seq = c.m_seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if(diff == 0)
+			{
+				if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			}
+			else if(diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = m_tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell& c = m_cells[pos & m_mask];
+		c.m_val = _val;
+		c.m_seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& _val) // false when empty
+	{
+		size_t pos = m_head.load(std::memory_order_relaxed);
+		for(;;)
+		{
+			cell& c = m_cells[pos & m_mask];
+			size_t seq = c.m_seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if(diff == 0)
+			{
+				if(m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+			}
+			else if(diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = m_head.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell& c = m_cells[pos & m_mask];
+		_val = c.m_val;
+		c.m_seq.store(pos + m_mask + 1, std::memory_order_release);
+		return true;
+	}
+
+protected:
+
+	struct cell
+	{
+		std::atomic<size_t> m_seq;
+		T m_val;
+	};
+
+	cell* m_cells;
+	size_t m_mask;
+
+	alignas(32) std::atomic<size_t> m_head; // keep producers and consumers off each other's cache line
+	alignas(32) std::atomic<size_t> m_tail;
+};
+
+#endif // #ifndef JSL_QUEUE_H
@@ -23,52 +23,176 @@
 
 
 #include <iostream>
+#include <algorithm>
 
 #define LOG_LOCAL_LEVEL ESP_LOG_NONE
 // #define LOG_LOCAL_LEVEL ESP_LOG_VERBOSE
 constexpr char ROUTER_LOGTAG[] = "ROUTER :";
-#include <esp_log.h>
+#include "jsl-port.h"
 
 #include "server/jsl-router.h"
 
 
 void jsl_router::addRoute(const char* _method, const char* _pattern, target_t _target)
 {
-	std::string method, m(_method);
-
-	std::locale loc;
-	for(auto elem : m)
+	method_t method = jsl_http_common::parse_method(_method);
+	if(method == jsl_http_common::METHOD_MAX)
 	{
-		method += std::tolower(elem,loc);
+		ESP_LOGE(ROUTER_LOGTAG,"Unknown method [%s], route %s ignored",_method,_pattern);
+		return;
 	}
+	addRoute(method,_pattern,_target);
+}
+
+void jsl_router::addRoute(method_t _method, const char* _pattern, target_t _target)
+{
+	if(_method >= jsl_http_common::METHOD_MAX) return;
 
 	path_t path;
-	jsl_str::splitv(path,_pattern,'/');
+	jsl_http_common::split(path,_pattern,'/');
+
+	for(size_t i = 0; i + 1 < path.size(); ++i)
+	{
+		if(path[i].find(":**}") != std::string_view::npos)
+		{
+			ESP_LOGE(ROUTER_LOGTAG,"Route %s ignored, {name:**} must be its last segment",_pattern);
+			return;
+		}
+	}
+
+	ESP_LOGI(ROUTER_LOGTAG,"Adding route : [%s] => %s",jsl_http_common::methods[_method],_pattern);
+	thaw(); // the flat arrays point into the branches
+	m_routes[_method].settle(_target,path);
+}
+
+jsl_router::target_t jsl_router::dispatch(method_t _method, const path_t& _path, vmap_t& _args)
+{
+	if(_method >= jsl_http_common::METHOD_MAX) return nullptr;
+
+	u32_t key = 0;
+	if(m_cache.size())
+	{
+		key = hash(_method,_path);
+		target_t target = cached(key,_method,_path,_args);
+		if(target != nullptr) return target; // no walk, no regex
+	}
+
+	captures_t caps;
+	caps.m_count = 0;
+
+	target_t target;
+	if(m_frozen)
+	{
+		target = m_roots[_method] != NO_NODE ? walk(m_roots[_method],caps,_path,0) : nullptr;
+	}
+	else
+	{
+		target = m_routes[_method].dispatch(caps,_path);
+	}
+	if(target == nullptr) return nullptr;
+
+	capture(_args,_path,caps.m_caps,caps.m_count);
 
-	ESP_LOGI(ROUTER_LOGTAG,"Adding route : [%s] => %s",method.c_str(),_pattern);
-	m_routes[method].settle(_target,path);
+	if(m_cache.size()) remember(key,_method,_path,caps,target);
+	return target;
 }
 
-jsl_router::target_t jsl_router::dispatch(const std::string& _method, const path_t& _path, pmap_t& _args)
+void jsl_router::capture(vmap_t& _args, const path_t& _path, const capture_t* _caps, u8_t _count)
 {
-	std::string method, m(_method);
+	for(u8_t i = 0; i < _count; ++i)
+	{
+		std::string_view val = _path[_caps[i].m_segt];
+		if(_caps[i].m_tail) jsl_http_common::scan_tail(_path,_caps[i].m_segt,&val); // checked when matched
+		_args.set(_caps[i].m_name,val);
+	}
+}
 
-	std::locale loc;
-	for(auto elem : m)
+void jsl_router::cache(u8_t _size)
+{
+	std::lock_guard<jsl_mutex> lock(m_lock);
+	m_cache.assign(_size,cached_t{});
+	m_tick = 0;
+}
+
+u32_t jsl_router::hash(method_t _method, const path_t& _path)
+{
+	u32_t h = 2166136261u; // FNV-1a
+	h = (h ^ (u8_t)_method) * 16777619u;
+	for(auto& segt : _path)
 	{
-		method += std::tolower(elem,loc);
+		for(char c : segt) h = (h ^ (u8_t)c) * 16777619u;
+		h = (h ^ '/') * 16777619u;
 	}
+	return h ? h : 1; // 0 marks empty entries
+}
 
-	if(m_routes.find(method) != m_routes.end())
+bool jsl_router::same(const std::string& _key, method_t _method, const path_t& _path)
+{
+	if(_key.empty() || _key[0] != (char)_method) return false;
+
+	size_t pos = 1;
+	for(auto& segt : _path)
 	{
-		// ESP_LOGI(ROUTER_LOGTAG,"Dispatching URI [%s]",method.c_str());
-		return m_routes[method].dispatch(_args,_path);
+		if(_key.compare(pos,segt.size(),segt) != 0 || pos + segt.size() >= _key.size() || _key[pos + segt.size()] != '/') return false;
+		pos += segt.size() + 1;
 	}
+	return pos == _key.size();
+}
+
+jsl_router::target_t jsl_router::cached(u32_t _hash, method_t _method, const path_t& _path, vmap_t& _args)
+{
+	std::lock_guard<jsl_mutex> lock(m_lock);
+	for(auto& c : m_cache)
+	{
+		if(c.m_hash != _hash || !same(c.m_key,_method,_path)) continue;
 
-	ESP_LOGE(ROUTER_LOGTAG,"Method Not Supported [%s]",method.c_str());
+		c.m_used = ++m_tick;
+		capture(_args,_path,c.m_args,c.m_nargs);
+		return c.m_target;
+	}
 	return nullptr;
 }
 
+void jsl_router::remember(u32_t _hash, method_t _method, const path_t& _path, const captures_t& _caps, target_t _target)
+{
+	if(_caps.m_count > CACHE_ARGS) return; // too many to keep
+
+	std::lock_guard<jsl_mutex> lock(m_lock);
+	cached_t* slot = &m_cache[0];
+	for(auto& c : m_cache)
+	{
+		if(c.m_hash == _hash && same(c.m_key,_method,_path)) return; // another worker was faster
+		if(c.m_used < slot->m_used) slot = &c; // least recently used, or empty
+	}
+
+	slot->m_hash = _hash;
+	slot->m_used = ++m_tick;
+	slot->m_key.assign(1,(char)_method);
+	for(auto& segt : _path)
+	{
+		slot->m_key.append(segt.data(),segt.size());
+		slot->m_key += '/';
+	}
+	slot->m_target = _target;
+	slot->m_nargs = _caps.m_count;
+	std::copy(_caps.m_caps,_caps.m_caps + _caps.m_count,slot->m_args);
+}
+
+u8_t jsl_router::allowed(const path_t& _path)
+{
+	u8_t mask = 0;
+	vmap_t args; // thrown away
+	for(int m = 0; m < jsl_http_common::METHOD_MAX; ++m)
+	{
+		args.clear();
+		if(dispatch((method_t)m,_path,args) != nullptr)
+		{
+			mask |= 1 << m;
+		}
+	}
+	return mask;
+}
+
 void jsl_router::branch::settle(target_t _target, const path_t& _path, u16_t _pos)
 {
 	if(_pos >= _path.size()) // Leaf !
@@ -78,7 +202,7 @@ void jsl_router::branch::settle(target_t _target, const path_t& _path, u16_t _po
 		return;
 	}
 
-	std::string segt = _path[_pos++];
+	std::string segt(_path[_pos++]);
 
 	// ESP_LOGD(ROUTER_LOGTAG,"Settle - segment is : %s",segt.c_str());
 
@@ -94,7 +218,7 @@ void jsl_router::branch::settle(target_t _target, const path_t& _path, u16_t _po
 	// ESP_LOGV(ROUTER_LOGTAG,"Settle - Popping branch");
 }
 
-jsl_router::target_t jsl_router::branch::dispatch(pmap_t& _args, const path_t& _path, u16_t _pos)
+jsl_router::target_t jsl_router::branch::dispatch(captures_t& _caps, const path_t& _path, u16_t _pos)
 {
 	if((_path.size() - _pos) < 1) // early out no dive
 	{
@@ -102,14 +226,15 @@ jsl_router::target_t jsl_router::branch::dispatch(pmap_t& _args, const path_t& _
 		return m_leaf; // return possible match
 	}
 
-	std::string segt = _path[_pos++];
+	std::string_view segt = _path[_pos++];
 
-	ESP_LOGD(ROUTER_LOGTAG,"Dispatch - segment is : %s",segt.c_str());
+	ESP_LOGD(ROUTER_LOGTAG,"Dispatch - segment is : %.*s",(int)segt.size(),segt.data());
 
-	if(m_childs.find(segt) != m_childs.end())
+	auto child = m_childs.find(segt);
+	if(child != m_childs.end())
 	{
 		ESP_LOGD(ROUTER_LOGTAG,"Dispatch - Diving branch");
-		target_t ret = m_childs[segt].dispatch(_args,_path,_pos);
+		target_t ret = child->second.dispatch(_caps,_path,_pos);
 		ESP_LOGV(ROUTER_LOGTAG,"Dispatch - Popping branch");
 		if(ret != nullptr)
 		{
@@ -120,20 +245,34 @@ jsl_router::target_t jsl_router::branch::dispatch(pmap_t& _args, const path_t& _
 
 	if(m_regs.size())
 	{
-		for(auto i = m_regs.begin(); i != m_regs.end(); ++i)
+		scan sc(*this,segt);
+		for(size_t i = 0; i < m_regs.size(); ++i)
 		{
-			ESP_LOGD(ROUTER_LOGTAG,"Dispatch - Testing regex : %s",i->first.c_str());
-			std::smatch m;
-			if(std::regex_match(segt,m,i->second.first))
+			const regref_t& r = m_regs[i];
+			ESP_LOGD(ROUTER_LOGTAG,"Dispatch - Testing regex : %s",r.m_name.c_str());
+			if(sc.match(i))
 			{
 				ESP_LOGD(ROUTER_LOGTAG,"Dispatch - Regex MATCH");
-				_args[i->first] = m[0];
-				target_t ret = i->second.second->dispatch(_args,_path,_pos);
+				u8_t mark = _caps.m_count;
+				if(r.m_type == PARAM_TAIL) // the rest of the path in one go, nothing deeper to search
+				{
+					if(r.m_child->m_leaf == nullptr || !jsl_http_common::scan_tail(_path,_pos - 1)) continue;
+					if(!_caps.push(r.m_name,_pos - 1,true))
+					{
+						ESP_LOGW(ROUTER_LOGTAG,"Dispatch - More than %d captures, %s dropped",MAX_CAPTURES,r.m_name.c_str());
+					}
+					return r.m_child->m_leaf;
+				}
+				if(!_caps.push(r.m_name,_pos - 1)) // whole segment matched
+				{
+					ESP_LOGW(ROUTER_LOGTAG,"Dispatch - More than %d captures, %s dropped",MAX_CAPTURES,r.m_name.c_str());
+				}
+				target_t ret = r.m_child->dispatch(_caps,_path,_pos);
 				if(ret != nullptr)
 				{
 					return ret;
 				}
-				// else continue to m_leaf
+				_caps.m_count = mark; // else forget it and continue to m_leaf
 			}
 		}
 	}
@@ -142,6 +281,34 @@ jsl_router::target_t jsl_router::branch::dispatch(pmap_t& _args, const path_t& _
 	return m_leaf; // return possible match
 }
 
+u8_t jsl_router::branch::param_type(const std::string& _spec)
+{
+	static const struct
+	{
+		const char* m_spec;
+		u8_t m_type;
+	} params[] = {
+		{"uint",PARAM_UINT},
+		{"int",PARAM_INT},
+		{"float",PARAM_FLOAT},
+		{"hex",PARAM_HEX},
+		{"slug",PARAM_SLUG},
+		{"**",PARAM_TAIL},
+		// regexes common enough to be scanned instead
+		{".*",PARAM_ANY},
+		{".+",PARAM_ANY}, // segments are never empty
+		{"\\d+",PARAM_DIGITS},
+		{"[0-9]+",PARAM_DIGITS},
+		{"\\d+(?:\\.\\d*)?",PARAM_DECIMAL}
+	};
+
+	for(auto& p : params)
+	{
+		if(_spec == p.m_spec) return p.m_type;
+	}
+	return PARAM_REGEX;
+}
+
 void jsl_router::branch::addReg(const std::string& _segt, jsl_router::branch& _child)
 {
 	size_t o = 0, p = 0, c = 0;
@@ -175,9 +342,336 @@ void jsl_router::branch::addReg(const std::string& _segt, jsl_router::branch& _c
 		return; // Ill formed
 	}
 
-	// ESP_LOGD(ROUTER_LOGTAG,"Settle - Regex Stored : %s",regex.c_str());
-	m_regs[pname] = regref_t(
-		std::regex(regex, std::regex_constants::ECMAScript),
-		&_child
-	);
+	auto ref = std::find_if(m_regs.begin(),m_regs.end(),[&](const regref_t& _r){ return _r.m_name == pname; });
+	if(ref == m_regs.end())
+	{
+		m_regs.emplace_back();
+		ref = m_regs.end() - 1;
+		ref->m_name = pname;
+	}
+	ref->m_spec = regex;
+	ref->m_child = &_child;
+	ref->m_type = param_type(regex);
+
+#ifndef JSL_NO_REGEX
+	if(ref->m_type == PARAM_REGEX)
+	{
+		// ESP_LOGD(ROUTER_LOGTAG,"Settle - Regex Stored : %s",regex.c_str());
+		ref->m_regex = std::regex(regex, std::regex_constants::ECMAScript);
+	}
+#else
+	if(ref->m_type == PARAM_REGEX) ESP_LOGE(ROUTER_LOGTAG,"Settle - Regex without std::regex [%s], never matches",regex.c_str());
+#endif
+
+	combine();
+}
+
+void jsl_router::branch::combine()
+{
+	// Siblings are tried from the narrowest type to the widest, then in the
+	// order they were added : "42" goes to {id:uint} before {name:slug},
+	// whatever their names. A tail goes last, it takes everything.
+	static const u8_t rank[] = {
+		8, // PARAM_ANY
+		0, // PARAM_UINT
+		2, // PARAM_INT
+		4, // PARAM_FLOAT
+		5, // PARAM_HEX
+		6, // PARAM_SLUG
+		1, // PARAM_DIGITS
+		3, // PARAM_DECIMAL
+		7, // PARAM_REGEX
+		9 // PARAM_TAIL
+	};
+	std::stable_sort(m_regs.begin(),m_regs.end(),[](const regref_t& _a, const regref_t& _b){ return rank[_a.m_type] < rank[_b.m_type]; });
+
+	m_kinds = 0;
+	for(auto& r : m_regs) m_kinds |= 1 << r.m_type;
+
+#ifndef JSL_NO_REGEX
+	// the regex ones as a single alternation, "(r1)|(r2)|...", so that one
+	// match tells which is the first of them to accept the segment
+	std::string any;
+	u16_t group = 1;
+	m_nregex = 0;
+	for(auto& r : m_regs)
+	{
+		if(r.m_type != PARAM_REGEX) continue;
+		if(m_nregex++) any += '|';
+		any += '(' + r.m_spec + ')';
+		r.m_group = group;
+		group += 1 + r.m_regex.mark_count();
+	}
+	m_any = m_nregex > 1 ? std::regex(any, std::regex_constants::ECMAScript) : std::regex();
+#endif
+}
+
+jsl_router::branch::scan::scan(const branch& _branch, std::string_view _segt) : m_branch(_branch), m_segt(_segt), m_kinds(1 << PARAM_ANY | 1 << PARAM_TAIL), m_first(-2)
+{
+	u16_t want = _branch.m_kinds & ~(1 << PARAM_ANY | 1 << PARAM_FLOAT | 1 << PARAM_REGEX | 1 << PARAM_TAIL);
+	if(want == 0) return;
+
+	// one pass over the segment for all the typed placeholders
+	size_t n = _segt.size();
+	size_t start = n && (_segt[0] == '-' || _segt[0] == '+') ? 1 : 0; // int sign
+	bool digits = n > 0, signed_digits = n > start, hex = n > 0 && n <= 8, slug = n > 0;
+	u8_t decimal = 0; // 0 no digit yet, 1 integral part, 2 after the dot, 3 failed
+	uint64_t val = 0; // of the digits after the sign, up to overflowing 32 bits
+
+	for(size_t i = 0; i < n; ++i)
+	{
+		char c = _segt[i];
+		bool d = c >= '0' && c <= '9';
+		if(d)
+		{
+			if(val <= 0xffffffffull) val = val * 10 + (c - '0');
+			if(decimal == 0) decimal = 1;
+		}
+		else
+		{
+			digits = false;
+			if(i >= start) signed_digits = false;
+			if(c == '.' && decimal == 1) decimal = 2;
+			else decimal = 3;
+		}
+		if(!d && !((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))) hex = false;
+		if(!d && !((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-' || c == '_')) slug = false;
+	}
+
+	bool neg = start && _segt[0] == '-';
+	if(digits) m_kinds |= 1 << PARAM_DIGITS;
+	if(digits && val <= 0xffffffffull) m_kinds |= 1 << PARAM_UINT;
+	if(signed_digits && val <= (neg ? 0x80000000ull : 0x7fffffffull)) m_kinds |= 1 << PARAM_INT;
+	if(decimal == 1 || decimal == 2) m_kinds |= 1 << PARAM_DECIMAL;
+	if(hex) m_kinds |= 1 << PARAM_HEX;
+	if(slug) m_kinds |= 1 << PARAM_SLUG;
+}
+
+bool jsl_router::branch::scan::match(size_t _i)
+{
+	const regref_t& r = m_branch.m_regs[_i];
+	switch(r.m_type)
+	{
+		case PARAM_FLOAT: return jsl_http_common::scan_float(m_segt); // exponents and all, not worth the main pass
+
+#ifndef JSL_NO_REGEX
+		case PARAM_REGEX:
+		{
+			if(m_branch.m_nregex < 2) return std::regex_match(m_segt.begin(),m_segt.end(),r.m_regex);
+
+			if(m_first == -2) // the alternation once, its first matching group tells the first regex that matches
+			{
+				m_first = -1;
+				std::match_results<std::string_view::const_iterator> m;
+				if(std::regex_match(m_segt.begin(),m_segt.end(),m,m_branch.m_any))
+				{
+					for(size_t k = 0; k < m_branch.m_regs.size(); ++k)
+					{
+						const regref_t& o = m_branch.m_regs[k];
+						if(o.m_type == PARAM_REGEX && m[o.m_group].matched)
+						{
+							m_first = k;
+							break;
+						}
+					}
+				}
+			}
+			if(m_first < 0 || (s16_t)_i < m_first) return false; // none or earlier ones can't
+			if((s16_t)_i == m_first) return true;
+			return std::regex_match(m_segt.begin(),m_segt.end(),r.m_regex); // past the first, only if it led nowhere
+		}
+#endif
+		default: return m_kinds & (1 << r.m_type);
+	}
+}
+
+void jsl_router::freeze()
+{
+	thaw();
+
+	std::map<std::string,u32_t> interned;
+	std::map<const branch*,u16_t> compiled; // regexes and literal edges may lead to the same branch
+	for(int m = 0; m < jsl_http_common::METHOD_MAX; ++m)
+	{
+		const branch& root = m_routes[m];
+		if(root.m_leaf != nullptr || root.m_childs.size()) // some route for this method
+		{
+			m_roots[m] = compile(root,interned,compiled);
+		}
+	}
+
+	if(m_nodes.size() >= 0xffff || m_edges.size() >= 0xffff || m_regs.size() >= 0xffff || m_pool.size() >= 0xffffffff)
+	{
+		ESP_LOGE(ROUTER_LOGTAG,"Too many routes to freeze");
+		thaw();
+		return;
+	}
+
+	m_nodes.shrink_to_fit();
+	m_edges.shrink_to_fit();
+	m_regs.shrink_to_fit();
+	m_pool.shrink_to_fit();
+	m_frozen = true;
+
+	ESP_LOGI(ROUTER_LOGTAG,"Routes frozen : %u nodes, %u edges, %u regexes, %u bytes of names",
+		(unsigned)m_nodes.size(),(unsigned)m_edges.size(),(unsigned)m_regs.size(),(unsigned)m_pool.size());
+}
+
+void jsl_router::thaw()
+{
+	m_frozen = false;
+	for(auto& r : m_roots) r = NO_NODE;
+
+	{
+		std::lock_guard<jsl_mutex> lock(m_lock);
+		for(auto& c : m_cache) // names point into what is being rebuilt
+		{
+			c.m_hash = 0;
+			c.m_used = 0;
+			c.m_nargs = 0;
+		}
+		m_tick = 0;
+	}
+	m_nodes.clear();
+	m_edges.clear();
+	m_regs.clear();
+	m_pool.clear();
+}
+
+u32_t jsl_router::intern(const std::string& _str, std::map<std::string,u32_t>& _interned)
+{
+	auto i = _interned.find(_str);
+	if(i != _interned.end()) return i->second;
+
+	u32_t off = m_pool.size();
+	m_pool += _str;
+	_interned[_str] = off;
+	return off;
+}
+
+u16_t jsl_router::compile(const branch& _branch, std::map<std::string,u32_t>& _interned, std::map<const branch*,u16_t>& _compiled)
+{
+	auto c = _compiled.find(&_branch);
+	if(c != _compiled.end()) return c->second;
+
+	u16_t idx = m_nodes.size();
+	_compiled[&_branch] = idx;
+	m_nodes.push_back(node_t{_branch.m_leaf,&_branch,(u16_t)m_edges.size(),(u16_t)_branch.m_childs.size(),0,0});
+
+	// the node's edges first, contiguous and in map order (sorted), then what they lead to
+	std::vector<const branch*> ends;
+	for(auto& child : _branch.m_childs)
+	{
+		std::string label = child.first;
+		u16_t segs = 1;
+		const branch* end = &child.second;
+		while(end->m_leaf == nullptr && end->m_regs.empty() && end->m_childs.size() == 1) // nothing would stop there
+		{
+			label += '/';
+			label += end->m_childs.begin()->first;
+			end = &end->m_childs.begin()->second;
+			++segs;
+		}
+
+		m_edges.push_back(edge_t{intern(label,_interned),(u16_t)label.size(),(u16_t)child.first.size(),segs,0});
+		ends.push_back(end);
+	}
+
+	u16_t first = m_nodes[idx].m_edge;
+	for(size_t i = 0; i < ends.size(); ++i)
+	{
+		u16_t node = compile(*ends[i],_interned,_compiled);
+		m_edges[first + i].m_node = node;
+	}
+
+	// regexes, in the order the branch tests them
+	u16_t reg = m_regs.size();
+	m_nodes[idx].m_reg = reg;
+	m_nodes[idx].m_nreg = _branch.m_regs.size();
+	for(auto& r : _branch.m_regs)
+	{
+		m_regs.push_back(reg_t{intern(r.m_name,_interned),(u16_t)r.m_name.size(),0});
+	}
+
+	size_t i = 0;
+	for(auto& r : _branch.m_regs)
+	{
+		u16_t node = compile(*r.m_child,_interned,_compiled);
+		m_regs[reg + i++].m_node = node;
+	}
+
+	return idx;
+}
+
+jsl_router::target_t jsl_router::walk(u16_t _node, captures_t& _caps, const path_t& _path, size_t _pos) const
+{
+	const node_t& node = m_nodes[_node];
+	if(_pos >= _path.size()) return node.m_leaf;
+
+	std::string_view segt = _path[_pos];
+
+	// plain segments : binary search on the edges first segment
+	const edge_t* lo = m_edges.data() + node.m_edge;
+	const edge_t* hi = lo + node.m_nedge;
+	while(lo < hi)
+	{
+		const edge_t* mid = lo + (hi - lo) / 2;
+		int cmp = pooled(mid->m_off,mid->m_first).compare(segt);
+		if(cmp < 0) lo = mid + 1;
+		else if(cmp > 0) hi = mid;
+		else
+		{
+			// then the rest of a merged edge, segment by segment
+			std::string_view rest = pooled(mid->m_off,mid->m_len).substr(mid->m_first);
+			size_t pos = _pos + 1;
+			bool match = true;
+			for(u16_t s = 1; s < mid->m_segs; ++s, ++pos)
+			{
+				std::string_view next = rest.substr(1,rest.find('/',1) - 1);
+				if(pos >= _path.size() || _path[pos] != next)
+				{
+					match = false;
+					break;
+				}
+				rest.remove_prefix(1 + next.size());
+			}
+			if(match)
+			{
+				target_t ret = walk(mid->m_node,_caps,_path,pos);
+				if(ret != nullptr) return ret;
+			}
+			break; // else continue to regexes
+		}
+	}
+
+	if(node.m_nreg == 0) return node.m_leaf;
+
+	branch::scan sc(*node.m_branch,segt);
+	for(u16_t i = 0; i < node.m_nreg; ++i)
+	{
+		const reg_t& r = m_regs[node.m_reg + i];
+		if(sc.match(i))
+		{
+			u8_t mark = _caps.m_count;
+			if(node.m_branch->m_regs[i].m_type == branch::PARAM_TAIL) // the rest of the path, no walk
+			{
+				target_t leaf = m_nodes[r.m_node].m_leaf;
+				if(leaf == nullptr || !jsl_http_common::scan_tail(_path,_pos)) continue;
+				if(!_caps.push(pooled(r.m_off,r.m_len),_pos,true))
+				{
+					ESP_LOGW(ROUTER_LOGTAG,"Dispatch - More than %d captures, %.*s dropped",MAX_CAPTURES,(int)r.m_len,m_pool.data() + r.m_off);
+				}
+				return leaf;
+			}
+			if(!_caps.push(pooled(r.m_off,r.m_len),_pos)) // whole segment matched
+			{
+				ESP_LOGW(ROUTER_LOGTAG,"Dispatch - More than %d captures, %.*s dropped",MAX_CAPTURES,(int)r.m_len,m_pool.data() + r.m_off);
+			}
+			target_t ret = walk(r.m_node,_caps,_path,_pos + 1);
+			if(ret != nullptr) return ret;
+			_caps.m_count = mark; // rolled back
+		}
+	}
+
+	return node.m_leaf; // possible match
 }
@@ -26,8 +26,13 @@
 #ifndef JSL_ROUTER_H
 #define JSL_ROUTER_H
 
+#ifndef JSL_NO_REGEX // leaves out std::regex, only the typed placeholders remain
 #include <regex>
+#endif
 
+#include <mutex>
+
+#include "jsl-port.h"
 #include "jsl-common.h"
 
 
@@ -35,41 +40,203 @@ class jsl_router
 {
 public:
 
-	using pmap_t = jsl_http_common::pmap_t;
+	using vmap_t = jsl_http_common::vmap_t;
 	using path_t = jsl_http_common::path_t;
 	using target_t = jsl_http_common::target_t;
+	using method_t = jsl_http_common::method_t;
+
+	jsl_router() : m_frozen(false), m_tick(0) { thaw(); }
+
+	void addRoute(const char* _method, const char* _pattern, target_t _target); // "GET", "post"...
+	void addRoute(method_t _method, const char* _pattern, target_t _target); // thaws a frozen router
+	target_t dispatch(method_t _method, const path_t& _path, vmap_t& _args); // args slice the path and the route names
+	u8_t allowed(const path_t& _path); // bit per method_t having a route for _path (405 Allow header)
+
+	void freeze(); // compiles the routes into flat arrays, once they are all added
+	inline bool frozen() const { return m_frozen; }
 
-	void addRoute(const char* _method, const char* _pattern, target_t _target);
-	target_t dispatch(const std::string& _method, const path_t& _path, pmap_t& _args);
+	void cache(u8_t _size); // remembers the targets of the last _size paths dispatched, 0 : off (default)
 
 protected:
 
+	// Captures are stacked while the routes are searched and rolled back when
+	// a branch leads nowhere, the args only get the final ones
+
+	static constexpr u8_t MAX_CAPTURES = 16;
+
+	typedef struct
+	{
+		std::string_view m_name;
+		u16_t m_segt; // its value, index in the path
+		bool m_tail; // up to the end of the path ({rest:**})
+	} capture_t;
+
+	typedef struct
+	{
+		capture_t m_caps[MAX_CAPTURES];
+		u8_t m_count;
+
+		inline bool push(std::string_view _name, u16_t _segt, bool _tail = false)
+		{
+			if(m_count == MAX_CAPTURES) return false;
+			m_caps[m_count++] = capture_t{_name,_segt,_tail};
+			return true;
+		}
+	} captures_t;
+
+	static void capture(vmap_t& _args, const path_t& _path, const capture_t* _caps, u8_t _count);
+
 	class branch
 	{
 	public:
 
-		branch(branch* _parent = nullptr) : m_parent(_parent), m_leaf(nullptr) {}
+#ifndef JSL_NO_REGEX
+		branch(branch* _parent = nullptr) : m_parent(_parent), m_leaf(nullptr), m_kinds(0), m_nregex(0) {}
+#else
+		branch(branch* _parent = nullptr) : m_parent(_parent), m_leaf(nullptr), m_kinds(0) {}
+#endif
 
 		void settle(target_t _target, const path_t& _path, u16_t _pos = 0);
-		target_t dispatch(pmap_t& _args, const path_t& _path, u16_t _pos = 0);
+		target_t dispatch(captures_t& _caps, const path_t& _path, u16_t _pos = 0);
 
 	protected:
 
+		friend class jsl_router; // freeze()
+
 		branch* m_parent;
 		target_t m_leaf;
 
 		void addReg(const std::string& _segt, branch& _child);
 
-		typedef std::pair<std::regex,branch*> regref_t;
-
-		std::map<std::string,branch> m_childs;
-		std::map<std::string,regref_t> m_regs;
+		typedef enum
+		{
+			PARAM_ANY, // {name}
+			PARAM_UINT, // {name:uint}
+			PARAM_INT,
+			PARAM_FLOAT,
+			PARAM_HEX,
+			PARAM_SLUG,
+			PARAM_DIGITS, // {name:\d+}, any length
+			PARAM_DECIMAL, // {name:\d+(?:\.\d*)?}
+			PARAM_REGEX, // anything else, through std::regex
+			PARAM_TAIL // {name:**}, the rest of the path, last segment of a pattern only
+		} param_t;
+
+		typedef struct
+		{
+			std::string m_name;
+			std::string m_spec; // after the ':'
+			u8_t m_type;
+#ifndef JSL_NO_REGEX
+			std::regex m_regex; // PARAM_REGEX only
+			u16_t m_group; // its capture group in m_any
+#endif
+			branch* m_child;
+		} regref_t;
+
+		class scan // a segment against all the placeholders of a branch at once
+		{
+		public:
+
+			scan(const branch& _branch, std::string_view _segt); // one pass for the typed ones
+			bool match(size_t _i); // the _i th placeholder, in priority order
+
+		protected:
+
+			const branch& m_branch;
+			std::string_view m_segt;
+			u16_t m_kinds; // PARAM_* the segment satisfies
+			s16_t m_first; // first regex placeholder matching, -1 none, -2 not evaluated yet
+		};
+
+		static u8_t param_type(const std::string& _spec);
+		void combine(); // priority order and m_any, once a placeholder is added
+
+		std::map<std::string,branch,std::less<>> m_childs; // transparent, looked up by string_view
+		std::vector<regref_t> m_regs; // most specific type first, then in the order they were added
+		u16_t m_kinds; // PARAM_* bits of m_regs
+#ifndef JSL_NO_REGEX
+		std::regex m_any; // the PARAM_REGEX ones as a single ordered alternation, when there are several
+		u8_t m_nregex;
+#endif
 	};
 
 protected:
 
-	std::map<std::string,branch> m_routes;
+	branch m_routes[jsl_http_common::METHOD_MAX]; // one tree per method
 
+	// Frozen routes : a radix tree over path segments, in contiguous arrays.
+	// A node's edges and regexes are ranges of m_edges and m_regs, edges are
+	// sorted by their first segment and chains of lone children are merged
+	// into one edge ("a/b/c"). Strings are interned in m_pool.
+
+	typedef struct
+	{
+		target_t m_leaf;
+		const branch* m_branch; // its placeholders matcher
+		u16_t m_edge; // first of m_edges
+		u16_t m_nedge;
+		u16_t m_reg; // first of m_regs
+		u16_t m_nreg;
+	} node_t;
+
+	typedef struct
+	{
+		u32_t m_off; // label in m_pool, segments joined by '/'
+		u16_t m_len;
+		u16_t m_first; // first segment length
+		u16_t m_segs;
+		u16_t m_node;
+	} edge_t;
+
+	typedef struct
+	{
+		u32_t m_off; // arg name in m_pool
+		u16_t m_len;
+		u16_t m_node;
+	} reg_t;
+
+	static constexpr u16_t NO_NODE = 0xffff;
+
+	u16_t compile(const branch& _branch, std::map<std::string,u32_t>& _interned, std::map<const branch*,u16_t>& _compiled);
+	u32_t intern(const std::string& _str, std::map<std::string,u32_t>& _interned);
+	target_t walk(u16_t _node, captures_t& _caps, const path_t& _path, size_t _pos) const;
+	void thaw();
+
+	inline std::string_view pooled(u32_t _off, u16_t _len) const { return std::string_view(m_pool.data() + _off, _len); }
+
+	bool m_frozen;
+	u16_t m_roots[jsl_http_common::METHOD_MAX]; // NO_NODE when the method has no route
+	std::vector<node_t> m_nodes;
+	std::vector<edge_t> m_edges;
+	std::vector<reg_t> m_regs;
+	std::string m_pool;
+
+	// Dispatch cache : a handful of entries for the paths requested over and
+	// over, found by hash then checked against the whole key. Captures are
+	// kept as they are, names point into the branches or the pool, so any
+	// addRoute() or freeze() empties it (thaw()).
+
+	static constexpr u8_t CACHE_ARGS = 4; // targets capturing more are not cached
+
+	typedef struct
+	{
+		u32_t m_hash; // 0 : empty
+		u32_t m_used; // m_tick when last hit, the lowest goes first
+		std::string m_key; // method then "segment/" each
+		target_t m_target;
+		u8_t m_nargs;
+		capture_t m_args[CACHE_ARGS];
+	} cached_t;
+
+	static u32_t hash(method_t _method, const path_t& _path);
+	static bool same(const std::string& _key, method_t _method, const path_t& _path);
+	target_t cached(u32_t _hash, method_t _method, const path_t& _path, vmap_t& _args);
+	void remember(u32_t _hash, method_t _method, const path_t& _path, const captures_t& _caps, target_t _target);
+
+	std::vector<cached_t> m_cache;
+	u32_t m_tick;
+	jsl_mutex m_lock; // workers dispatch concurrently
 };
 
 #endif // #ifndef JSL_ROUTER_H
@@ -0,0 +1,413 @@
+/*
+	jsl-routes.h
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+#ifndef JSL_ROUTES_H
+#define JSL_ROUTES_H
+
+#include "jsl-common.h"
+
+// Compile time routes : when they are all known at build time, the compiler
+// parses the patterns and merges them into a segment trie, the result is a
+// constexpr table (.rodata) walked without allocating and without anything
+// to build at startup. Same syntax and matching order as jsl_router, typed
+// placeholders only ({id:uint}, {name}, {rest:**}...), std::regex has no
+// constexpr form.
+//
+//	static constexpr jsl_routes::route_t s_routes[] = {
+//		{jsl_http_common::METHOD_GET, "/api/status", status},
+//		{jsl_http_common::METHOD_GET, "/api/sensors/{id:uint}", sensor},
+//	};
+//	static constexpr auto s_table = jsl_routes::compile<s_routes>();
+//	...
+//	jsl_http::addRoutes(s_table);
+
+void jsl_routes_unsupported_pattern(); // never defined, evaluating a call to it breaks the build
+
+class jsl_routes
+{
+public:
+
+	using vmap_t = jsl_http_common::vmap_t;
+	using path_t = jsl_http_common::path_t;
+	using target_t = jsl_http_common::target_t;
+	using method_t = jsl_http_common::method_t;
+
+	typedef struct
+	{
+		method_t m_method;
+		const char* m_pattern;
+		target_t m_target;
+	} route_t;
+
+	typedef enum
+	{
+		SEG_LITERAL,
+		SEG_ANY, // {name}, {name:.*}
+		SEG_UINT,
+		SEG_INT,
+		SEG_FLOAT,
+		SEG_HEX,
+		SEG_SLUG,
+		SEG_DIGITS, // {name:\d+}
+		SEG_DECIMAL, // {name:\d+(?:\.\d*)?}
+		SEG_TAIL // {name:**}, the rest of the path
+	} seg_t;
+
+	typedef struct
+	{
+		target_t m_leaf;
+		u16_t m_edge; // first of its edges : literals sorted by length then text, placeholders by priority
+		u16_t m_nlit;
+		u16_t m_nparam;
+	} node_t;
+
+	typedef struct
+	{
+		std::string_view m_label; // literal segment or capture name
+		u8_t m_type; // seg_t
+		u16_t m_node;
+		u16_t m_next; // sibling, while compiling
+	} edge_t;
+
+	static constexpr u16_t NONE = 0xffff;
+	static constexpr u8_t MAX_CAPTURES = 16;
+
+	template<size_t NODES> class table;
+
+	constexpr jsl_routes() : m_nodes(nullptr), m_edges(nullptr) {}
+	constexpr jsl_routes(const node_t* _nodes, const edge_t* _edges) : m_nodes(_nodes), m_edges(_edges) {}
+
+	template<const auto& _routes> static constexpr auto compile(); // table of exactly the nodes needed
+
+	inline bool empty() const { return m_nodes == nullptr; }
+	target_t dispatch(method_t _method, const path_t& _path, vmap_t& _args) const; // args slice the path and the patterns
+	u8_t allowed(const path_t& _path) const; // bit per method_t having a route for _path
+
+	// compile time helpers
+
+	template<size_t R>
+	static constexpr size_t bound(const route_t (&_routes)[R]) // nodes : the method roots and one per segment at most
+	{
+		size_t n = jsl_http_common::METHOD_MAX;
+		for(auto& r : _routes)
+		{
+			std::string_view p(r.m_pattern);
+			for(size_t i = 0; i < p.size(); ++i)
+			{
+				if(p[i] != '/' && (i == 0 || p[i - 1] == '/')) ++n;
+			}
+		}
+		return n;
+	}
+
+	static constexpr u8_t classify(std::string_view _segt, std::string_view& _label)
+	{
+		size_t o = _segt.find('{');
+		if(o == std::string_view::npos)
+		{
+			_label = _segt;
+			return SEG_LITERAL;
+		}
+
+		size_t c = _segt.find('}',o);
+		size_t p = _segt.find(':',o);
+		if(c == std::string_view::npos) jsl_routes_unsupported_pattern(); // ill formed
+		if(p > c)
+		{
+			_label = _segt.substr(o + 1,c - (o + 1));
+			return SEG_ANY;
+		}
+
+		_label = _segt.substr(o + 1,p - (o + 1));
+		std::string_view spec = _segt.substr(p + 1,c - (p + 1));
+		if(spec == "**") return SEG_TAIL;
+		if(spec == "uint") return SEG_UINT;
+		if(spec == "int") return SEG_INT;
+		if(spec == "float") return SEG_FLOAT;
+		if(spec == "hex") return SEG_HEX;
+		if(spec == "slug") return SEG_SLUG;
+		if(spec == ".*" || spec == ".+") return SEG_ANY;
+		if(spec == "\\d+" || spec == "[0-9]+") return SEG_DIGITS;
+		if(spec == "\\d+(?:\\.\\d*)?") return SEG_DECIMAL;
+
+		jsl_routes_unsupported_pattern(); // a regex, jsl_router only
+		return SEG_ANY;
+	}
+
+	static constexpr u8_t rank(u8_t _type) // jsl_router's placeholder priority, narrowest type first
+	{
+		constexpr u8_t ranks[] = {0, 9, 1, 3, 5, 6, 7, 2, 4, 10};
+		return ranks[_type];
+	}
+
+	static constexpr bool before(const edge_t& _a, const edge_t& _b) // sibling order
+	{
+		if(_a.m_type == SEG_LITERAL && _b.m_type == SEG_LITERAL)
+		{
+			if(_a.m_label.size() != _b.m_label.size()) return _a.m_label.size() < _b.m_label.size();
+			return _a.m_label < _b.m_label;
+		}
+		return rank(_a.m_type) < rank(_b.m_type); // same type : in the order they were given
+	}
+
+protected:
+
+	typedef struct
+	{
+		std::string_view m_name;
+		u16_t m_segt; // its value, index in the path
+		bool m_tail; // up to the end of the path
+	} capture_t;
+
+	typedef struct
+	{
+		capture_t m_caps[MAX_CAPTURES];
+		u8_t m_count;
+
+		inline bool push(std::string_view _name, u16_t _segt, bool _tail = false) // false when full, the route still matches
+		{
+			if(m_count == MAX_CAPTURES) return false;
+			m_caps[m_count++] = capture_t{_name,_segt,_tail};
+			return true;
+		}
+	} captures_t;
+
+	target_t walk(u16_t _node, captures_t& _caps, const path_t& _path, size_t _pos) const;
+	static bool match(u8_t _type, std::string_view _segt);
+
+	const node_t* m_nodes; // the METHOD_MAX roots first
+	const edge_t* m_edges;
+};
+
+template<size_t NODES>
+class jsl_routes::table
+{
+public:
+
+	static constexpr size_t EDGES = NODES > jsl_http_common::METHOD_MAX ? NODES - jsl_http_common::METHOD_MAX : 1; // one leads to each node but the roots
+
+	template<size_t R>
+	constexpr table(const route_t (&_routes)[R]) : m_nodes{}, m_edges{}, m_used(jsl_http_common::METHOD_MAX)
+	{
+		// the trie with linked siblings first
+		edge_t links[EDGES] = {};
+		u16_t first[NODES] = {};
+		for(auto& f : first) f = NONE;
+
+		for(auto& r : _routes)
+		{
+			if(r.m_method >= jsl_http_common::METHOD_MAX) jsl_routes_unsupported_pattern();
+
+			u16_t n = r.m_method; // its root
+			bool tail = false;
+			std::string_view pat(r.m_pattern);
+			size_t p = 0;
+			while(p < pat.size())
+			{
+				size_t e = pat.find('/',p);
+				if(e == std::string_view::npos) e = pat.size();
+				if(e > p)
+				{
+					if(tail) jsl_routes_unsupported_pattern(); // {name:**} must come last
+					n = descend(n,pat.substr(p,e - p),links,first);
+					tail = links[n - jsl_http_common::METHOD_MAX].m_type == SEG_TAIL;
+				}
+				p = e + 1;
+			}
+			m_nodes[n].m_leaf = r.m_target;
+		}
+
+		// then each node's edges laid out contiguously, in order
+		u16_t out = 0;
+		for(size_t n = 0; n < m_used; ++n)
+		{
+			m_nodes[n].m_edge = out;
+			for(u16_t l = first[n]; l != NONE; l = links[l].m_next)
+			{
+				m_edges[out] = links[l];
+				m_edges[out].m_next = NONE;
+				if(links[l].m_type == SEG_LITERAL) ++m_nodes[n].m_nlit;
+				else ++m_nodes[n].m_nparam;
+				++out;
+			}
+		}
+	}
+
+	template<size_t W>
+	constexpr table(const table<W>& _wide) : m_nodes{}, m_edges{}, m_used(NODES) // trimmed to what was used
+	{
+		for(size_t n = 0; n < NODES; ++n) m_nodes[n] = _wide.m_nodes[n];
+		for(size_t e = 0; e < EDGES && e < table<W>::EDGES; ++e) m_edges[e] = _wide.m_edges[e];
+	}
+
+	constexpr operator jsl_routes() const { return jsl_routes(m_nodes,m_edges); }
+
+	inline target_t dispatch(method_t _method, const path_t& _path, vmap_t& _args) const { return jsl_routes(*this).dispatch(_method,_path,_args); }
+
+	node_t m_nodes[NODES];
+	edge_t m_edges[EDGES];
+	size_t m_used;
+
+protected:
+
+	constexpr u16_t descend(u16_t _node, std::string_view _segt, edge_t* _links, u16_t* _first)
+	{
+		edge_t e = {};
+		e.m_type = classify(_segt,e.m_label);
+
+		u16_t* link = &_first[_node];
+		while(*link != NONE)
+		{
+			const edge_t& o = _links[*link];
+			if(o.m_type == e.m_type && o.m_label == e.m_label) return o.m_node; // shared prefix
+			if(before(e,o)) break;
+			link = &_links[*link].m_next;
+		}
+
+		if(m_used >= NODES || m_used >= NONE) jsl_routes_unsupported_pattern(); // can't happen, bound() counts them all
+		e.m_node = m_used++;
+		e.m_next = *link;
+		u16_t idx = e.m_node - jsl_http_common::METHOD_MAX;
+		_links[idx] = e;
+		*link = idx;
+		return e.m_node;
+	}
+};
+
+template<const auto& _routes>
+constexpr auto jsl_routes::compile()
+{
+	constexpr table<bound(_routes)> wide(_routes);
+	return table<wide.m_used>(wide);
+}
+
+inline jsl_routes::target_t jsl_routes::dispatch(method_t _method, const path_t& _path, vmap_t& _args) const
+{
+	if(m_nodes == nullptr || _method >= jsl_http_common::METHOD_MAX) return nullptr;
+
+	captures_t caps;
+	caps.m_count = 0;
+	target_t target = walk(_method,caps,_path,0);
+	if(target == nullptr) return nullptr;
+
+	for(u8_t i = 0; i < caps.m_count; ++i)
+	{
+		std::string_view val = _path[caps.m_caps[i].m_segt];
+		if(caps.m_caps[i].m_tail) jsl_http_common::scan_tail(_path,caps.m_caps[i].m_segt,&val); // checked when matched
+		_args.set(caps.m_caps[i].m_name,val);
+	}
+	return target;
+}
+
+inline u8_t jsl_routes::allowed(const path_t& _path) const
+{
+	u8_t mask = 0;
+	if(m_nodes == nullptr) return mask;
+
+	for(int m = 0; m < jsl_http_common::METHOD_MAX; ++m)
+	{
+		captures_t caps;
+		caps.m_count = 0;
+		if(walk(m,caps,_path,0) != nullptr) mask |= 1 << m;
+	}
+	return mask;
+}
+
+inline jsl_routes::target_t jsl_routes::walk(u16_t _node, captures_t& _caps, const path_t& _path, size_t _pos) const
+{
+	const node_t& node = m_nodes[_node];
+	if(_pos >= _path.size()) return node.m_leaf;
+
+	std::string_view segt = _path[_pos];
+
+	// literals : length first, then the text
+	const edge_t* lo = m_edges + node.m_edge;
+	const edge_t* hi = lo + node.m_nlit;
+	while(lo < hi)
+	{
+		const edge_t* mid = lo + (hi - lo) / 2;
+		int cmp = mid->m_label.size() < segt.size() ? -1 : mid->m_label.size() > segt.size() ? 1 : mid->m_label.compare(segt);
+		if(cmp < 0) lo = mid + 1;
+		else if(cmp > 0) hi = mid;
+		else
+		{
+			target_t ret = walk(mid->m_node,_caps,_path,_pos + 1);
+			if(ret != nullptr) return ret;
+			break; // else continue to placeholders
+		}
+	}
+
+	const edge_t* param = m_edges + node.m_edge + node.m_nlit;
+	for(u16_t i = 0; i < node.m_nparam; ++i, ++param)
+	{
+		if(!match(param->m_type,segt)) continue;
+
+		if(param->m_type == SEG_TAIL) // the rest of the path in one go, no walk
+		{
+			if(m_nodes[param->m_node].m_leaf == nullptr || !jsl_http_common::scan_tail(_path,_pos)) continue;
+			_caps.push(param->m_label,(u16_t)_pos,true);
+			return m_nodes[param->m_node].m_leaf;
+		}
+
+		u8_t mark = _caps.m_count;
+		_caps.push(param->m_label,(u16_t)_pos); // whole segment matched, past MAX_CAPTURES only the capture is dropped
+		target_t ret = walk(param->m_node,_caps,_path,_pos + 1);
+		if(ret != nullptr) return ret;
+		_caps.m_count = mark; // rolled back
+	}
+
+	return node.m_leaf; // possible match
+}
+
+inline bool jsl_routes::match(u8_t _type, std::string_view _segt)
+{
+	switch(_type)
+	{
+		case SEG_ANY:
+		case SEG_TAIL: return true;
+		case SEG_UINT: return jsl_http_common::scan_uint(_segt);
+		case SEG_INT: return jsl_http_common::scan_int(_segt);
+		case SEG_FLOAT: return jsl_http_common::scan_float(_segt);
+		case SEG_HEX: return jsl_http_common::scan_hex(_segt);
+		case SEG_SLUG: return jsl_http_common::scan_slug(_segt);
+
+		case SEG_DIGITS:
+		case SEG_DECIMAL:
+		{
+			size_t i = 0;
+			while(i < _segt.size() && _segt[i] >= '0' && _segt[i] <= '9') ++i;
+			if(i == 0) return false;
+			if(i < _segt.size() && _type == SEG_DECIMAL && _segt[i] == '.')
+			{
+				for(++i; i < _segt.size() && _segt[i] >= '0' && _segt[i] <= '9'; ++i);
+			}
+			return i == _segt.size();
+		}
+
+		default: return false;
+	}
+}
+
+#endif // #ifndef JSL_ROUTES_H
@@ -0,0 +1,82 @@
+/*
+	jsl-transport.h
+
+	This scource file is part of the jsl-esp32 project.
+
+	Author: Lorenzo Pastrana
+	Copyright © 2019 Lorenzo Pastrana
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU General Public License as published by the
+	Free Software Foundation, either version 3 of the License, or (at your
+	option) any later version.
+
+	This program is distributed in the hope that it will be useful, but
+	WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+	or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+	for more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program. If not, see http://www.gnu.org/licenses/.
+
+*/
+
+
+
+#ifndef JSL_TRANSPORT_H
+#define JSL_TRANSPORT_H
+
+#include <string>
+
+#include "jsl-port.h"
+
+class jsl_transport // network backend used by jsl_http (lwIP netconn, POSIX epoll)
+{
+public:
+
+	typedef struct
+	{
+		const void* m_data;
+		size_t m_len;
+	} vec_t;
+
+	class conn
+	{
+	public:
+
+		conn() : m_ctx(nullptr) {}
+		virtual ~conn() {}
+
+		virtual err_t recv(char* _buf, size_t _len, size_t& _read) = 0; // never blocks, ERR_WOULDBLOCK when drained
+		// gathered, in as few segments as possible, never blocks : _sent falls short when the connection is full
+		// (EVENT_WRITE once it has room again). Not _copy : the data stays put until acknowledged (flash)
+		virtual err_t send(const vec_t* _vec, int _count, size_t& _sent, bool _copy = true) = 0;
+		virtual err_t write(const void* _data, size_t _len, bool _copy = true) = 0; // returns once all is sent, or the send timeout expired
+
+		void* m_ctx; // owner's connection state
+	};
+
+	typedef enum
+	{
+		EVENT_ACCEPT = 0x01, // m_conn is a new connection
+		EVENT_READ = 0x02, // m_conn has data (or an error / eof) to recv
+		EVENT_WRITE = 0x04 // m_conn has room to send more (or an error)
+	} event_flags_t;
+
+	typedef struct
+	{
+		conn* m_conn;
+		u8_t m_flags;
+	} event_t;
+
+	virtual ~jsl_transport() {}
+
+	virtual err_t listen(u16_t _port, u16_t _max_conns) = 0; // _max_conns sizes what the backend keeps per connection
+	virtual int wait(event_t* _events, int _max, u32_t _timeout) = 0; // ready count, < 0 on failure
+	virtual void wake() = 0; // have wait() return early, callable from any task
+	virtual void watch(conn* _conn, u8_t _events) = 0; // the events reported for _conn, EVENT_READ on accept, 0 : none
+	virtual void close(conn* _conn) = 0; // closes and releases _conn
+	virtual void shutdown() = 0;
+};
+
+#endif // #ifndef JSL_TRANSPORT_H